@@ -6,6 +6,7 @@
 #define DEEP_LEARNING_FROM_SCRATCH_LAYER_HPP
 
 #include <cmath>
+#include <stdexcept>
 #include "../primitive/primitive.hpp"
 
 namespace dpl {
@@ -13,23 +14,49 @@ namespace dpl {
   template <typename Type, int... Dims>
   class Relu {
    public:
+    static constexpr int SIZE = GetFact<sizeof...(Dims) - 1, Dims...>::value;
+
+    Relu() { mask = make_bitmask_ptr<SIZE>(); }
+
     ndarrayPtr<Type, Dims...> forward(const ndarrayPtr<Type, Dims...>& input) {
       auto ret = make_ndarray_ptr<Type, Dims...>();
-      for (int i = 0; i < input->size(); i++) {
-        if (input->linerAt(i) >= 0)
-          ret->linerAt(i) = input->linerAt(i);
-        else
-          ret->linerAt(i) = 0;
-      }
-      mask = ret;
-      return std::move(ret);
+      relu_forward(input->data(), ret->data(), *mask);
+      return ret;
     }
 
     ndarrayPtr<Type, Dims...> backward(const ndarrayPtr<Type, Dims...>& dout) {
       auto ret = make_ndarray_ptr<Type, Dims...>();
-      for (int i = 0; i < dout->size(); i++)
-        ret->linerAt(i) = mask->linerAt(i) > 0 ? dout->linerAt(i) : 0;
-      return std::move(ret);
+      masked_copy(dout->data(), *mask, ret->data());
+      return ret;
+    }
+
+    /**
+     * forward / backward overwriting their argument, which is returned.
+     * Only for buffers nobody reads afterwards; Network uses them when
+     * the neighbouring layers hand over buffers they do not keep.
+     */
+    ndarrayPtr<Type, Dims...> forward_inplace(
+        const ndarrayPtr<Type, Dims...>& input) {
+      relu_forward(input->data(), input->data(), *mask);
+      return input;
+    }
+    ndarrayPtr<Type, Dims...> backward_inplace(
+        const ndarrayPtr<Type, Dims...>& dout) {
+      masked_copy(dout->data(), *mask, dout->data());
+      return dout;
+    }
+
+    // inference : no mask kept, safe to call concurrently
+    ndarrayPtr<Type, Dims...> infer(
+        const ndarrayPtr<Type, Dims...>& input) const {
+      auto ret = make_ndarray_ptr<Type, Dims...>();
+      relu_(input->data(), ret->data());
+      return ret;
+    }
+    ndarrayPtr<Type, Dims...> infer_inplace(
+        const ndarrayPtr<Type, Dims...>& input) const {
+      relu_(input->data(), input->data());
+      return input;
     }
 
     using output = ndarrayPtr<Type, Dims...>;
@@ -37,7 +64,15 @@ namespace dpl {
     template <class Func>
     void update(Func optimize) {}
 
-    ndarrayPtr<float, Dims...> mask;
+    // bit i : input i was positive in the last forward
+    bitmaskPtr<SIZE> mask;
+
+   private:
+    static void relu_(const Type* in, Type* out) {
+      parallel_for(0, SIZE, [=](int lo, int hi) {
+        for (int i = lo; i < hi; i++) out[i] = in[i] > 0 ? in[i] : 0;
+      }, PARALLEL_GRAIN);
+    }
   };
 
   template <typename Type, int... Dims>
@@ -63,23 +98,30 @@ namespace dpl {
       db = make_ndarray_ptr<Type, K>();
 
       w->rand();
-      w = *w * (Type)sqrt(2.0 / N);
+      *w = *w * (Type)sqrt(2.0 / N);
       b->fill(0);
     }
 
     ndarrayPtr<Type, N, K> forward(const ndarrayPtr<Type, N, Dims...>& input) {
-      x = input->template reshape<N, M::value>();
+      x = reshape<N, M::value>(input);
       ndarrayPtr<Type, N, K> ret = dot(*x, *w);
-      for (int i = 0; i < N; i++)
-        ret->at(i) = *(ret->at(i) + *b);
-      return std::move(ret);
+      add_along<1>(*ret, *b);
+      return ret;
+    }
+
+    // inference : forward without keeping x
+    ndarrayPtr<Type, N, K> infer(
+        const ndarrayPtr<Type, N, Dims...>& input) const {
+      ndarrayPtr<Type, N, K> ret = dot(*reshape<N, M::value>(input), *w);
+      add_along<1>(*ret, *b);
+      return ret;
     }
 
     ndarrayPtr<Type, N, Dims...> backward(const ndarrayPtr<Type, N, K>& dout) {
-      ndarrayPtr<Type, N, M::value> ret = dot(*dout, *(w->T()));
-      dw = dot(*(x->T()), *dout);
+      ndarrayPtr<Type, N, M::value> ret = dot_nt(*dout, *w);
+      dw = dot_tn(*x, *dout);
       db = dout->template sum<0>();
-      return std::move(ret->template reshape<N, Dims...>());
+      return reshape<N, Dims...>(ret);
     }
 
     using output = ndarrayPtr<Type, N, K>;
@@ -115,23 +157,28 @@ namespace dpl {
   template <typename Type, int... Dims>
   class Dropout {
    public:
-    Dropout() { mask = make_ndarray_ptr<float, Dims...>(); }
+    static constexpr int SIZE = GetFact<sizeof...(Dims) - 1, Dims...>::value;
+
+    Dropout() { mask = make_bitmask_ptr<SIZE>(); }
 
     ndarrayPtr<Type, Dims...> forward(const ndarrayPtr<Type, Dims...>& input,
                                       bool train_flag = true) {
-      if (!train_flag) return *input * (float)(1.0 - dropout_ratio);
-      auto rnd = make_ndarray_ptr<Type, Dims...>();
-      rnd->rand();
-      for (int i = 0; i < rnd->size(); i++) {
-        if (rnd->linerAt(i) > dropout_ratio)
-          mask->linerAt(i) = 1.0;
-        else
-          mask->linerAt(i) = 0.0;
-      }
-      return *input * *(mask);
+      if (!train_flag) return input * (float)(1.0 - dropout_ratio);
+      random_keep_mask(*mask, dropout_ratio);
+      auto ret = make_ndarray_ptr<Type, Dims...>();
+      masked_copy(input->data(), *mask, ret->data());
+      return ret;
     }
     ndarrayPtr<Type, Dims...> backward(const ndarrayPtr<Type, Dims...>& dout) {
-      return *dout * *mask;
+      auto ret = make_ndarray_ptr<Type, Dims...>();
+      masked_copy(dout->data(), *mask, ret->data());
+      return ret;
+    }
+
+    // inference : forward(input, false)
+    ndarrayPtr<Type, Dims...> infer(
+        const ndarrayPtr<Type, Dims...>& input) const {
+      return input * (float)(1.0 - dropout_ratio);
     }
 
     void set_dropout_ratio(float v) { dropout_ratio = v; }
@@ -142,7 +189,8 @@ namespace dpl {
     void update(Func optimize) {}
 
     float dropout_ratio;
-    ndarrayPtr<float, Dims...> mask;
+    // bit i : element i is kept
+    bitmaskPtr<SIZE> mask;
   };
 
   template <typename Type, int... Dims>
@@ -170,45 +218,111 @@ namespace dpl {
     Convolution() {
       w = make_ndarray_ptr<Type, FILTER_N, C, FILTER_H, FILTER_W>();
       b = make_ndarray_ptr<Type, FILTER_N>();
+      dw = make_ndarray_ptr<Type, FILTER_N, C, FILTER_H, FILTER_W>();
+      db = make_ndarray_ptr<Type, FILTER_N>();
 
       w->rand();
-      w = *w * (Type)sqrt(2.0 / N);
+      *w = *w * (Type)sqrt(2.0 / N);
       b->fill(0);
     }
 
+    // select the convolution kernel, Auto by default
+    void set_algorithm(ConvAlgorithm v) {
+      if (v == ConvAlgorithm::Winograd && !WINOGRAD)
+        throw std::invalid_argument(
+            "Convolution : Winograd needs a 3x3 filter and stride 1");
+      algorithm_ = v;
+    }
+
+    // kernel used by forward/backward (Auto resolved)
+    ConvAlgorithm algorithm() const {
+      if (algorithm_ != ConvAlgorithm::Auto) return algorithm_;
+      if (WINOGRAD && C >= CONV_WINOGRAD_MIN_CHANNELS &&
+          FILTER_N >= CONV_WINOGRAD_MIN_CHANNELS)
+        return ConvAlgorithm::Winograd;
+      return FILTER_H * FILTER_W <= 9 &&
+                     OUT_H::value * OUT_W::value >= CONV_DIRECT_MIN_PLANE
+                 ? ConvAlgorithm::Direct
+                 : ConvAlgorithm::Im2col;
+    }
+
+    /**
+     * train_flag = false is inference : the Winograd filter transform is
+     * computed once and reused until the next training forward or
+     * clear_filter_cache(). Training forwards always transform the
+     * current weights.
+     */
     ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> forward(
-        const ndarrayPtr<Type, N, C, H, W>& input) {
-      col = input->template im2col<FILTER_H, FILTER_W, STRIDE, PAD>();
-      col_w = w->template reshape<FILTER_N, C * FILTER_H * FILTER_W>()->T();
+        const ndarrayPtr<Type, N, C, H, W>& input, bool train_flag = true) {
+      x = input;
+      if constexpr (WINOGRAD) {
+        if (algorithm() == ConvAlgorithm::Winograd) {
+          if (!wino_u)
+            wino_u = make_ndarray_ptr<Type, 16, FILTER_N, C>();
+          if (train_flag || !wino_cached_)
+            winograd_filter_transform(*w, *wino_u);
+          wino_cached_ = !train_flag;
+          return winograd_(*input, *wino_u);
+        }
+      }
+      if (algorithm() == ConvAlgorithm::Direct) return direct_(*input);
 
-      auto out = dot(*col, *col_w);
-      for (int i = 0; i < N * OUT_H::value * OUT_W::value; i++)
-        for (int l = 0; l < FILTER_N; l++)
-          out->at(i, l) = out->at(i, l) + b->at(l);
-      ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> ret =
-          out->template reshape<N, OUT_H::value, OUT_W::value, FILTER_N>()
-              ->template transpose<0, 3, 1, 2>();
-      return std::move(ret);
+      if (!col)
+        col = make_ndarray_ptr<Type, N * OUT_H::value * OUT_W::value,
+                               C * FILTER_H * FILTER_W>();
+      col_w = reshape<FILTER_N, C * FILTER_H * FILTER_W>(w);
+      return im2col_(*input, *col);
+    }
+
+    /**
+     * inference storing nothing, safe to call from many threads at once,
+     * also while another thread runs forward or clear_filter_cache(). The
+     * Winograd filter transform is computed from the current w on every
+     * call, the cache kept by forward(in, false) is never read.
+     */
+    ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> infer(
+        const ndarrayPtr<Type, N, C, H, W>& input) const {
+      if constexpr (WINOGRAD) {
+        if (algorithm() == ConvAlgorithm::Winograd) {
+          auto u = make_ndarray_ptr<Type, 16, FILTER_N, C>();
+          winograd_filter_transform(*w, *u);
+          return winograd_(*input, *u);
+        }
+      }
+      if (algorithm() == ConvAlgorithm::Direct) return direct_(*input);
+      auto buf = make_ndarray_ptr<Type, N * OUT_H::value * OUT_W::value,
+                                  C * FILTER_H * FILTER_W>();
+      return im2col_(*input, *buf);
     }
 
     ndarrayPtr<Type, N, C, H, W> backward(
         const ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value>& dout) {
-      auto out =
-          dout->template transpose<0, 2, 3, 1>()
-              ->template reshape<N * OUT_H::value * OUT_W::value, FILTER_N>();
+      if (algorithm() != ConvAlgorithm::Im2col) {
+        auto ret = make_ndarray_ptr<Type, N, C, H, W>();
+        conv2d_direct_backward_filter<Type, N, C, H, W, FILTER_N, FILTER_H,
+                                      FILTER_W, STRIDE, PAD>(*x, *dout, *dw,
+                                                             *db);
+        conv2d_direct_backward_data<Type, N, C, H, W, FILTER_N, FILTER_H,
+                                    FILTER_W, STRIDE, PAD>(*dout, *w, *ret);
+        return ret;
+      }
+
+      auto out = reshape<N * OUT_H::value * OUT_W::value, FILTER_N>(
+          dout->view().template transpose<0, 2, 3, 1>().copy());
       db = out->template sum<0>();
-      auto tdw = dot(*(col->T()), *out);
-      dw = tdw->template transpose<1, 0>()
-               ->template reshape<FILTER_N, C, FILTER_H, FILTER_W>();
+      dw = reshape<FILTER_N, C, FILTER_H, FILTER_W>(dot_tn(*out, *col));
 
-      auto dcol = dot(*out, *(col_w->T()));
-      ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value> ret =
+      auto dcol = dot(*out, *col_w);
+      ndarrayPtr<Type, N, C, H, W> ret =
           dcol->template col2im<N, C, H, W, FILTER_H, FILTER_W, STRIDE, PAD>();
-      return std::move(ret);
+      return ret;
     };
 
     using output = ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value>;
 
+    // drop the cached Winograd filter transform after changing w by hand
+    void clear_filter_cache() { wino_cached_ = false; }
+
     template <class Func>
     void update(Func optimize) {
       optimize(w, dw);
@@ -217,12 +331,60 @@ namespace dpl {
     ndarrayPtr<Type, FILTER_N, C, FILTER_H, FILTER_W> w;
     ndarrayPtr<Type, FILTER_N> b;
 
+    // input of the last forward, read by the direct backward
+    ndarrayPtr<Type, N, C, H, W> x;
+    // im2col buffer, allocated on first im2col forward
     ndarrayPtr<Type, N * OUT_H::value * OUT_W::value, C * FILTER_H * FILTER_W>
         col;
-    ndarrayPtr<Type, C * FILTER_H * FILTER_W, FILTER_N> col_w;
+    // w viewed as [FILTER_N, C * FILTER_H * FILTER_W], shares w's buffer
+    ndarrayPtr<Type, FILTER_N, C * FILTER_H * FILTER_W> col_w;
+    // Winograd filter transform [16, FILTER_N, C]
+    ndarrayPtr<Type, 16, FILTER_N, C> wino_u;
 
     ndarrayPtr<Type, FILTER_N> db;
     ndarrayPtr<Type, FILTER_N, C, FILTER_H, FILTER_W> dw;
+
+   private:
+    ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> winograd_(
+        const ndarray<Type, N, C, H, W>& input,
+        const ndarray<Type, 16, FILTER_N, C>& u) const {
+      auto ret =
+          make_ndarray_ptr<Type, N, FILTER_N, OUT_H::value, OUT_W::value>();
+      conv2d_winograd_forward<Type, N, C, H, W, FILTER_N, PAD>(input, u, *b,
+                                                               *ret);
+      return ret;
+    }
+
+    ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> direct_(
+        const ndarray<Type, N, C, H, W>& input) const {
+      auto ret =
+          make_ndarray_ptr<Type, N, FILTER_N, OUT_H::value, OUT_W::value>();
+      conv2d_direct_forward<Type, N, C, H, W, FILTER_N, FILTER_H, FILTER_W,
+                            STRIDE, PAD>(input, *w, *b, *ret);
+      return ret;
+    }
+
+    // col : im2col workspace
+    ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> im2col_(
+        const ndarray<Type, N, C, H, W>& input,
+        ndarray<Type, N * OUT_H::value * OUT_W::value,
+                C * FILTER_H * FILTER_W>& col) const {
+      input.template im2col<FILTER_H, FILTER_W, STRIDE, PAD>(col);
+      auto out = dot_nt(col, *reshape<FILTER_N, C * FILTER_H * FILTER_W>(w));
+      add_along<1>(*out, *b);
+      ndarrayPtr<Type, N, FILTER_N, OUT_H::value, OUT_W::value> ret =
+          out->view()
+              .template reshape<N, OUT_H::value, OUT_W::value, FILTER_N>()
+              .template transpose<0, 3, 1, 2>()
+              .copy();
+      return ret;
+    }
+
+    static constexpr bool WINOGRAD =
+        FILTER_H == 3 && FILTER_W == 3 && STRIDE == 1;
+
+    ConvAlgorithm algorithm_ = ConvAlgorithm::Auto;
+    bool wino_cached_ = false;
   };
 
   template <typename Type, int N, int C, int H, int W, int FILTER_N,
@@ -254,42 +416,36 @@ namespace dpl {
     };
 
    public:
+    using index_type = typename PoolIndex<POOL_H * POOL_W>::type;
+
     Pooling() {
-      x = make_ndarray_ptr<Type, N, C, H, W>();
       arg_max =
-          make_ndarray_ptr<unsigned, N * OUT_H::value * OUT_W::value * C>();
+          make_ndarray_ptr<index_type, N, C, OUT_H::value, OUT_W::value>();
     }
 
     ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value> forward(
         const ndarrayPtr<Type, N, C, H, W>& input) {
-      *x = *input;
-      auto col_t = x->template im2col<POOL_H, POOL_W, STRIDE, 0>();
-      auto col = col_t->template reshape<N * OUT_H::value * OUT_W::value * C,
-                                         POOL_H * POOL_W>();
-
-      arg_max = col->template argmax<1>();
-      auto out = col->template max<1>();
-      ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value> ret =
-          out->template reshape<N, OUT_H::value, OUT_W::value, C>()
-              ->template transpose<0, 3, 1, 2>();
-      return std::move(ret);
+      auto ret = make_ndarray_ptr<Type, N, C, OUT_H::value, OUT_W::value>();
+      max_pool2d_forward<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(
+          *input, *ret, *arg_max);
+      return ret;
+    }
+
+    // inference : no argmax kept
+    ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value> infer(
+        const ndarrayPtr<Type, N, C, H, W>& input) const {
+      auto ret = make_ndarray_ptr<Type, N, C, OUT_H::value, OUT_W::value>();
+      max_pool2d_forward<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(*input,
+                                                                  *ret);
+      return ret;
     }
 
     ndarrayPtr<Type, N, C, H, W> backward(
         const ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value>& dout) {
-      auto out = dout->template transpose<0, 2, 3, 1>();
-
-      auto dmax = make_ndarray_ptr<Type, N * OUT_H::value * OUT_W::value * C,
-                                   POOL_H * POOL_W>();
-      dmax->fill(0);
-      for (int i = 0; i < arg_max->size(); i++) {
-        dmax->at(i, arg_max->at(i)) = dout->linerAt(i);
-      }
-      auto dcol = dmax->template reshape<N * OUT_H::value * OUT_W::value,
-                                         C * POOL_H * POOL_W>();
-      ndarrayPtr<Type, N, C, H, W> dx =
-          dcol->template col2im<N, C, H, W, POOL_H, POOL_W, STRIDE, 0>();
-      return std::move(dx);
+      auto dx = make_ndarray_ptr<Type, N, C, H, W>();
+      max_pool2d_backward<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(
+          *dout, *arg_max, *dx);
+      return dx;
     };
 
     using output = ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value>;
@@ -298,8 +454,8 @@ namespace dpl {
     void update(Func optimize) {}
 
    private:
-    ndarrayPtr<Type, N, C, H, W> x;
-    ndarrayPtr<unsigned, N * OUT_H::value * OUT_W::value * C> arg_max;
+    // position of the maximum inside every window, fy * POOL_W + fx
+    ndarrayPtr<index_type, N, C, OUT_H::value, OUT_W::value> arg_max;
   };
 
   template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
@@ -313,27 +469,91 @@ namespace dpl {
     return os;
   }
 
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE>
+  class AvgPooling {
+   private:
+    struct OUT_H {
+      enum { value = (H - POOL_H) / STRIDE + 1 };
+    };
+    struct OUT_W {
+      enum { value = (W - POOL_W) / STRIDE + 1 };
+    };
+
+   public:
+    ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value> forward(
+        const ndarrayPtr<Type, N, C, H, W>& input) {
+      auto ret = make_ndarray_ptr<Type, N, C, OUT_H::value, OUT_W::value>();
+      avg_pool2d_forward<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(*input,
+                                                                  *ret);
+      return ret;
+    }
+
+    // forward keeps nothing either
+    ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value> infer(
+        const ndarrayPtr<Type, N, C, H, W>& input) const {
+      auto ret = make_ndarray_ptr<Type, N, C, OUT_H::value, OUT_W::value>();
+      avg_pool2d_forward<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(*input,
+                                                                  *ret);
+      return ret;
+    }
+
+    ndarrayPtr<Type, N, C, H, W> backward(
+        const ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value>& dout) {
+      auto dx = make_ndarray_ptr<Type, N, C, H, W>();
+      avg_pool2d_backward<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(*dout,
+                                                                   *dx);
+      return dx;
+    };
+
+    using output = ndarrayPtr<Type, N, C, OUT_H::value, OUT_W::value>;
+
+    template <class Func>
+    void update(Func optimize) {}
+  };
+
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE>
+  std::ostream& operator<<(
+      std::ostream& os,
+      const AvgPooling<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>& layer) {
+    os << "======== AvgPooling Layer ========" << std::endl;
+    os << "Args : " << ndarray<int, 7>({N, C, H, W, POOL_H, POOL_W, STRIDE})
+       << std::endl;
+    return os;
+  }
+
   template <typename Type, int N, int M>
   class SoftmaxWithLoss {
    public:
     SoftmaxWithLoss() {
-      y = make_ndarray_ptr<Type, N, M>();
-      t = make_ndarray_ptr<Type, N, M>();
+      dx = make_ndarray_ptr<Type, N, M>();
     }
 
+    // teacher : one-hot rows
     Type forward(const ndarrayPtr<Type, N, M>& input,
                  const ndarrayPtr<Type, N, M>& teacher) {
-      y = softmax(*input);
-      *t = *teacher;
+      auto label = teacher->template argmax<1>();
+      return softmax_cross_entropy(*input, *label, *dx);
+    };
 
-      Type loss = cross_entropy_error(*y, *teacher);
-      return loss;
+    // teacher : class index of every row
+    template <typename Label>
+    Type forward(const ndarrayPtr<Type, N, M>& input,
+                 const ndarrayPtr<Label, N>& teacher) {
+      return softmax_cross_entropy(*input, *teacher, *dx);
     };
 
+    // inference : class probabilities of every row
+    ndarrayPtr<Type, N, M> infer(const ndarrayPtr<Type, N, M>& input) const {
+      return softmax(*input);
+    }
+
+    // the gradient is computed by forward
     ndarrayPtr<Type, N, M> backward(const Type dout = (Type)1) {
-      // TODO : now only one-hot-expression
-      ndarrayPtr<Type, N, M> dx = *(*y - *t) / (Type)N;
-      return std::move(dx);
+      if (dout == (Type)1) return dx;
+      ndarrayPtr<Type, N, M> ret = dx * dout;
+      return ret;
     };
 
     using output = Type;
@@ -341,8 +561,8 @@ namespace dpl {
     template <class Func>
     void update(Func optimize) {}
 
-    ndarrayPtr<Type, N, M> y;
-    ndarrayPtr<Type, N, M> t;
+    // d loss / d input of the last forward
+    ndarrayPtr<Type, N, M> dx;
   };
 
   template <typename Type, int N, int M>
@@ -350,8 +570,7 @@ namespace dpl {
                            const SoftmaxWithLoss<Type, N, M>& layer) {
     os << "======== SoftmaxWithLoss Layer ========" << std::endl;
     os << "Args : " << N << ", " << M << std::endl;
-    os << "y : " << *(layer.y) << std::endl;
-    os << "t : " << *(layer.t) << std::endl;
+    os << "dx : " << *(layer.dx) << std::endl;
     return os;
   }
 
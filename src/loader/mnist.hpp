@@ -63,23 +63,19 @@ namespace dpl {
     }
 
     template <int SIZE>
-    ndarrayPtr<float, SIZE> load_label_(std::string file) {
+    ndarrayPtr<uint8_t, SIZE> load_label_(std::string file) {
       std::ifstream fin(file, std::ios::in | std::ios::binary);
       if (!fin) {
         std::cout << "can not open file : " << file << std::endl;
         return nullptr;
       }
 
-      auto array = make_ndarray_ptr<float, SIZE>();
+      auto array = make_ndarray_ptr<uint8_t, SIZE>();
 
       fin.seekg(8, std::ios_base::beg);  // offset = 8
-      for (int i = 0; i < SIZE; i++) {   // TODO 高速読み取り
-        uint8_t c;
-        fin.read((char *)&c, sizeof(c));
-        array->at(i) = (float)c;
-      }
+      fin.read((char *)array->data(), SIZE);
       fin.close();
-      return std::move(array);
+      return array;
     }
 
     template <int N, int C, int H, int W>
@@ -108,11 +104,12 @@ namespace dpl {
     };
 
     template <int N>
-    ndarrayPtr<float, N, 10> one_hot_label_(const ndarrayPtr<float, N> &array) {
+    ndarrayPtr<float, N, 10> one_hot_label_(
+        const ndarrayPtr<uint8_t, N> &array) {
       auto ret = make_ndarray_ptr<float, N, 10>();
       ret->fill(0);
       for (int i = 0; i < N; i++) ret->at(i, array->at(i)) = (float)1;
-      return std::move(ret);
+      return ret;
     };
 
    public:
@@ -133,8 +130,8 @@ namespace dpl {
       download();
 
       std::cout << "::load label::" << std::endl;
-      auto train_label = load_label_<TRAIN_NUM>(key_files[1]);
-      auto test_label = load_label_<TEST_NUM>(key_files[3]);
+      train_label = load_label_<TRAIN_NUM>(key_files[1]);
+      test_label = load_label_<TEST_NUM>(key_files[3]);
 
       std::cout << "::load image::" << std::endl;
       train_img =
@@ -146,12 +143,6 @@ namespace dpl {
         train_img->each([](float &v) { v /= 255.0; });
         test_img->each([](float &v) { v /= 255.0; });
       }
-
-      {  // one-hot-label
-        std::cout << "::convert one-hot-label::" << std::endl;
-        train_one_hot_label = one_hot_label_(train_label);
-        test_one_hot_label = one_hot_label_(test_label);
-      }
     }
 
     const ndarrayPtr<float, TRAIN_NUM, IMAGE_C, IMAGE_H, IMAGE_W>
@@ -164,10 +155,20 @@ namespace dpl {
       return test_img;
     };
 
-    const ndarrayPtr<float, TRAIN_NUM, 10> getTrainLabel() {
+    // class index (0 - 9) of every image
+    const ndarrayPtr<uint8_t, TRAIN_NUM> &getTrainLabel() {
+      return train_label;
+    };
+    const ndarrayPtr<uint8_t, TEST_NUM> &getTestLabel() { return test_label; };
+
+    // one-hot labels, built on first use
+    const ndarrayPtr<float, TRAIN_NUM, 10> &getTrainOneHotLabel() {
+      if (!train_one_hot_label)
+        train_one_hot_label = one_hot_label_(train_label);
       return train_one_hot_label;
     };
-    const ndarrayPtr<float, TEST_NUM, 10> &getTestLabel() {
+    const ndarrayPtr<float, TEST_NUM, 10> &getTestOneHotLabel() {
+      if (!test_one_hot_label) test_one_hot_label = one_hot_label_(test_label);
       return test_one_hot_label;
     };
 
@@ -175,6 +176,8 @@ namespace dpl {
     std::string url_base;
     std::array<std::string, 4> key_files;
 
+    ndarrayPtr<uint8_t, TRAIN_NUM> train_label;
+    ndarrayPtr<uint8_t, TEST_NUM> test_label;
     ndarrayPtr<float, TRAIN_NUM, 10> train_one_hot_label;
     ndarrayPtr<float, TEST_NUM, 10> test_one_hot_label;
 
@@ -155,6 +155,35 @@ namespace dpl {
     };
     // =====================================================================
 
+    // ============================ AvgPooling =============================
+    template <class OUT, int POOL_H, int POOL_W, int STRIDE>
+    struct AvgPoolingBuild;
+
+    template <int N, int C, int H, int W, int POOL_H, int POOL_W, int STRIDE>
+    struct AvgPoolingBuild<ndarrayPtr<float, N, C, H, W>, POOL_H, POOL_W,
+                           STRIDE> {
+      using type = AvgPooling<float, N, C, H, W, POOL_H, POOL_W, STRIDE>;
+    };
+
+    /**
+     * Average Pooling Layer
+     *
+     * @tparam POOL_H Height of Pool.
+     * @tparam POOL_W Width of Pool.
+     * @tparam STRIDE Stride of Pool.
+     * @return NetwrokBuilder adding AvgPooling Layer.
+     */
+    template <int POOL_H, int POOL_W, int STRIDE>
+    auto AvgPooling() {
+      NetworkBuilder_<typename AvgPoolingBuild<typename Last::output, POOL_H,
+                                               POOL_W, STRIDE>::type,
+                      Last, Layers...>
+          builder_;
+      builder_.set_dropout_ratio_list_(dropout_ratio_list);
+      return builder_;
+    };
+    // =====================================================================
+
     // ======================== SoftmaxWithLoss ============================
     template <class OUT>
     struct SoftmaxWithLossBuild;
@@ -5,64 +5,326 @@
 #ifndef DEEP_LEARNING_FROM_SCRATCH_NETWORK_HPP
 #define DEEP_LEARNING_FROM_SCRATCH_NETWORK_HPP
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <type_traits>
 #include "../layer/layer.hpp"
 #include "../primitive/primitive.hpp"
 
 namespace dpl {
 
+  //================================================================
+  // ReleasesOutput<Layer>
+  // forward returns a buffer the layer keeps no reference to, so the
+  // next layer may overwrite it
+  // ReleasesGradient<Layer>
+  // the same for the gradient returned by backward
+  template <class Layer>
+  struct ReleasesOutput : std::false_type {};
+  template <class Layer>
+  struct ReleasesGradient : std::false_type {};
+
+  template <typename Type, int... Dims>
+  struct ReleasesOutput<Relu<Type, Dims...>> : std::true_type {};
+  template <typename Type, int... Dims>
+  struct ReleasesGradient<Relu<Type, Dims...>> : std::true_type {};
+  template <typename Type, int N, int K, int... Dims>
+  struct ReleasesOutput<Affine<Type, N, K, Dims...>> : std::true_type {};
+  template <typename Type, int N, int K, int... Dims>
+  struct ReleasesGradient<Affine<Type, N, K, Dims...>> : std::true_type {};
+  template <typename Type, int... Dims>
+  struct ReleasesOutput<Dropout<Type, Dims...>> : std::true_type {};
+  template <typename Type, int... Dims>
+  struct ReleasesGradient<Dropout<Type, Dims...>> : std::true_type {};
+  template <typename Type, int N, int C, int H, int W, int FILTER_N,
+            int FILTER_H, int FILTER_W, int STRIDE, int PAD>
+  struct ReleasesOutput<Convolution<Type, N, C, H, W, FILTER_N, FILTER_H,
+                                    FILTER_W, STRIDE, PAD>> : std::true_type {};
+  template <typename Type, int N, int C, int H, int W, int FILTER_N,
+            int FILTER_H, int FILTER_W, int STRIDE, int PAD>
+  struct ReleasesGradient<Convolution<Type, N, C, H, W, FILTER_N, FILTER_H,
+                                      FILTER_W, STRIDE, PAD>>
+      : std::true_type {};
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE>
+  struct ReleasesOutput<Pooling<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>>
+      : std::true_type {};
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE>
+  struct ReleasesGradient<Pooling<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>>
+      : std::true_type {};
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE>
+  struct ReleasesOutput<AvgPooling<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>>
+      : std::true_type {};
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE>
+  struct ReleasesGradient<AvgPooling<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>>
+      : std::true_type {};
+  //================================================================
+
+  //================================================================
+  // train_forward_(layer, in, dead), infer_forward_(layer, in, dead),
+  // layer_infer_(layer, in, dead), backward_(layer, dout, dead)
+  // dead : std::true_type when nothing reads the argument afterwards,
+  // which lets Relu work in place. infer_forward_ calls
+  // layer.forward(in, false) for layers that take a train flag.
+  template <class Layer, class In, class Dead>
+  auto train_forward_(Layer& layer, const In& in, Dead) {
+    return layer.forward(in);
+  }
+  template <typename Type, int... Dims>
+  auto train_forward_(Relu<Type, Dims...>& layer,
+                      const ndarrayPtr<Type, Dims...>& in, std::true_type) {
+    return layer.forward_inplace(in);
+  }
+
+  template <class Layer, class In>
+  auto infer_forward_flag_(Layer& layer, const In& in, int)
+      -> decltype(layer.forward(in, false)) {
+    return layer.forward(in, false);
+  }
+  template <class Layer, class In>
+  auto infer_forward_flag_(Layer& layer, const In& in, long) {
+    return layer.forward(in);
+  }
+  template <class Layer, class In, class Dead>
+  auto infer_forward_(Layer& layer, const In& in, Dead) {
+    return infer_forward_flag_(layer, in, 0);
+  }
+  template <typename Type, int... Dims>
+  auto infer_forward_(Relu<Type, Dims...>& layer,
+                      const ndarrayPtr<Type, Dims...>& in, std::true_type) {
+    return layer.forward_inplace(in);
+  }
+
+  // layer_infer_(layer, in, dead) : the const, stateless counterpart
+  template <class Layer, class In, class Dead>
+  auto layer_infer_(const Layer& layer, const In& in, Dead) {
+    return layer.infer(in);
+  }
+  template <typename Type, int... Dims>
+  auto layer_infer_(const Relu<Type, Dims...>& layer,
+                    const ndarrayPtr<Type, Dims...>& in, std::true_type) {
+    return layer.infer_inplace(in);
+  }
+
+  template <class Layer, class Dout, class Dead>
+  auto backward_(Layer& layer, const Dout& dout, Dead) {
+    return layer.backward(dout);
+  }
+  template <typename Type, int... Dims>
+  auto backward_(Relu<Type, Dims...>& layer,
+                 const ndarrayPtr<Type, Dims...>& dout, std::true_type) {
+    return layer.backward_inplace(dout);
+  }
+  //================================================================
+
+  //================================================================
+  // teacher_class_(teacher, i)
+  // class of sample i : the label itself for [N] class indices, the
+  // argmax of row i for [N, M] one-hot rows
+  template <typename T, int N, class S>
+  unsigned teacher_class_(
+      const ndarray_view<T, std::integer_sequence<int, N>, S>& teacher,
+      int i) {
+    return teacher.at(i);
+  }
+  template <typename T, int N, int M, class S>
+  unsigned teacher_class_(
+      const ndarray_view<T, std::integer_sequence<int, N, M>, S>& teacher,
+      int i) {
+    auto t = teacher.at(i);
+    unsigned k = 0;
+    for (int m = 1; m < M; m++)
+      if (t.at(k) < t.at(m)) k = m;
+    return k;
+  }
+  //================================================================
+
+  //================================================================
+  // eval_batch_<B>(in, begin, rows, buf)
+  // rows [begin, begin + rows) of in as a B row batch : in's own buffer
+  // when in is a contiguous float view and the batch is full, otherwise
+  // copied into buf (allocated on first use) and zero padded
+  template <int B, typename InType, int N, int... Dims, class Strides>
+  ndarrayPtr<float, B, Dims...> eval_batch_(
+      const ndarray_view<InType, std::integer_sequence<int, N, Dims...>,
+                         Strides>& in,
+      int begin, int rows, ndarrayPtr<float, B, Dims...>& buf) {
+    using view_type =
+        ndarray_view<InType, std::integer_sequence<int, N, Dims...>, Strides>;
+    constexpr int ROW = GetFact<sizeof...(Dims) - 1, Dims...>::value;
+    if constexpr (view_type::is_contiguous() &&
+                  std::is_same<std::remove_const_t<InType>, float>::value) {
+      // not owning : in outlives the batch, predict never writes its input
+      if (rows == B)
+        return ndarrayPtr<float, B, Dims...>(
+            std::shared_ptr<void>(),
+            reinterpret_cast<ndarray<float, B, Dims...>*>(
+                const_cast<float*>(in.data()) + begin * ROW));
+    }
+    if (!buf) buf = make_ndarray_ptr<float, B, Dims...>();
+    for (int n = 0; n < rows; n++) in.at(begin + n).copy_to(buf->at(n));
+    std::fill(buf->data() + rows * ROW, buf->data() + B * ROW, 0.0f);
+    return buf;
+  }
+  //================================================================
+
+  /**
+   * Evaluation<M>
+   *
+   * Result of Network::evaluate over M classes.
+   */
+  template <int M>
+  struct Evaluation {
+    Evaluation() { confusion.fill(0); }
+
+    int total() const {
+      int ret = 0;
+      for (int i = 0; i < M * M; i++) ret += confusion[i];
+      return ret;
+    }
+    int correct() const {
+      int ret = 0;
+      for (int m = 0; m < M; m++) ret += confusion.at(m, m);
+      return ret;
+    }
+    float accuracy() const {
+      return total() ? (float)correct() / total() : 0.0f;
+    }
+
+    // confusion.at(truth, predicted) : number of samples
+    ndarray<int, M, M> confusion;
+  };
+
   template <class... Layers>
   class Network;
 
   template <>
   class Network<> {};
 
+  /**
+   * Network<Layers...>
+   *
+   * The layer list is static, so whether a buffer passed between two
+   * layers is still referenced afterwards is known at compile time
+   * (ReleasesOutput / ReleasesGradient). Relu then overwrites its input
+   * in forward and the incoming gradient in backward. The caller's input
+   * is never overwritten.
+   */
   template <class First, class... Others>
   class Network<First, Others...> {
    public:
+    using layer_type = First;
+    // number of output classes
+    static constexpr int CLASSES = Network<Others...>::CLASSES;
+
     template <int... Dims>
     auto predict(const ndarrayPtr<float, Dims...>& in) {
-      auto out = layer.forward(in);
-      return std::move(network_.predict(out));
+      return predict_(in, std::false_type());
     }
 
     template <class Teacher, int... Dims>
     float loss(const ndarrayPtr<float, Dims...>& in, const Teacher& teacher) {
-      auto out = layer.forward(in);
-      return network_.loss(out, teacher);
-    }
-
-    template <int BATCH_SIZE, int N, int M, int... Dims>
-    float accuracy(const ndarrayPtr<float, N, Dims...>& in,
-                   const ndarrayPtr<float, N, M>& teacher) {
-      auto tx = make_ndarray_ptr<float, BATCH_SIZE, Dims...>();
-
-      ndarrayPtr<unsigned, N> t = teacher->template argmax<1>();
-      auto tt = make_ndarray_ptr<float, BATCH_SIZE>();
-
-      float acc = 0.0;
-      for (int i = 0; i < N / BATCH_SIZE; i++) {
-        for (int n = 0; n < BATCH_SIZE; n++) {
-          tx->at(n) = in->at(i * BATCH_SIZE + n);
-          tt->at(n) = t->at(i * BATCH_SIZE + n);
-        }
-        ndarrayPtr<float, BATCH_SIZE, M> y = predict(tx);
-        ndarrayPtr<unsigned, BATCH_SIZE> yy = y->template argmax<1>();
-        for (int n = 0; n < BATCH_SIZE; n++) {
-          if (yy->at(n) == tt->at(n)) acc += 1.0;
-        }
-      }
-      return acc / N;
+      return loss_(in, teacher, std::false_type());
+    }
+
+    /**
+     * predict through every layer's const infer() : nothing is stored for
+     * backward, and any number of threads may call it at once on one
+     * network as long as nobody trains it meanwhile.
+     */
+    template <int... Dims>
+    auto infer(const ndarrayPtr<float, Dims...>& in) const {
+      return infer_(in, std::false_type());
+    }
+
+    // teacher : one-hot [N, M] rows or [N] class indices
+    template <int BATCH_SIZE, int N, int... Dims, typename TeacherType,
+              int... TeacherDims>
+    float accuracy(
+        const ndarrayPtr<float, N, Dims...>& in,
+        const ndarrayPtr<TeacherType, N, TeacherDims...>& teacher) const {
+      return accuracy<BATCH_SIZE>(in->view(), teacher->view());
     };
 
-    auto backward() { return layer.backward(network_.backward()); }
+    template <int BATCH_SIZE, class In, class Teacher>
+    float accuracy(const In& in, const Teacher& teacher) const {
+      return evaluate<BATCH_SIZE>(in, teacher).accuracy();
+    };
+
+    /**
+     * Inference over every sample of in, BATCH_SIZE (the network's batch
+     * size) at a time; the last batch may be partial.
+     *
+     * Batches run concurrently on the thread pool through the stateless
+     * infer(), sharing this network. Full batches of a contiguous float
+     * input are read in place.
+     *
+     * @return accuracy and confusion counts against teacher
+     */
+    template <int BATCH_SIZE, typename InType, typename TeacherType, int N,
+              int... Dims, int... TeacherDims, class InStrides,
+              class TeacherStrides>
+    Evaluation<CLASSES> evaluate(
+        const ndarray_view<InType, std::integer_sequence<int, N, Dims...>,
+                           InStrides>& in,
+        const ndarray_view<TeacherType,
+                           std::integer_sequence<int, N, TeacherDims...>,
+                           TeacherStrides>& teacher) const {
+      constexpr int BATCHES = (N + BATCH_SIZE - 1) / BATCH_SIZE;
+      const int threads = thread_pool().size();
+      Evaluation<CLASSES> init;
+      return parallel_reduce(
+          0, BATCHES, init,
+          [&](int lo, int hi) {
+            ndarrayPtr<float, BATCH_SIZE, Dims...> buf;
+            Evaluation<CLASSES> ret;
+            for (int i = lo; i < hi; i++) {
+              const int begin = i * BATCH_SIZE;
+              const int rows = std::min(BATCH_SIZE, N - begin);
+              auto x = eval_batch_<BATCH_SIZE>(in, begin, rows, buf);
+              auto y = infer(x);
+              auto label = y->template argmax<1>();
+              for (int n = 0; n < rows; n++)
+                ret.confusion.at(teacher_class_(teacher, begin + n),
+                                 label->at(n))++;
+            }
+            return ret;
+          },
+          [](Evaluation<CLASSES> a, const Evaluation<CLASSES>& b) {
+            for (int i = 0; i < CLASSES * CLASSES; i++)
+              a.confusion[i] += b.confusion[i];
+            return a;
+          },
+          (BATCHES + threads - 1) / threads);
+    }
+
+    auto backward() {
+      return backward_(
+          layer, network_.backward(),
+          ReleasesGradient<typename Network<Others...>::layer_type>());
+    }
 
-    template <int... Dims, int N, int M>
-    void gradient(const ndarrayPtr<float, N, Dims...>& in,
-                  const ndarrayPtr<float, N, M>& teacher) {
-      loss(in, teacher);
+    /**
+     * One training forward pass and the backward pass over it; every
+     * layer is left holding its parameter gradients.
+     * @return loss of the forward pass
+     */
+    template <int... Dims, int N, class Teacher>
+    float forward_backward(const ndarrayPtr<float, N, Dims...>& in,
+                           const Teacher& teacher) {
+      const float ret = loss(in, teacher);
       backward();
+      return ret;
+    }
+
+    template <int... Dims, int N, class Teacher>
+    float gradient(const ndarrayPtr<float, N, Dims...>& in,
+                   const Teacher& teacher) {
+      return forward_backward(in, teacher);
     };
 
     void set_dropout_ratio_(std::vector<float>::iterator now,
@@ -76,6 +338,28 @@ namespace dpl {
     const Network<Others...>& next() const { return network_; }
 
    private:
+    template <class...>
+    friend class Network;
+
+    template <class Dead, int... Dims>
+    auto predict_(const ndarrayPtr<float, Dims...>& in, Dead dead) {
+      auto out = infer_forward_(layer, in, dead);
+      return network_.predict_(out, ReleasesOutput<First>());
+    }
+
+    template <class Dead, int... Dims>
+    auto infer_(const ndarrayPtr<float, Dims...>& in, Dead dead) const {
+      auto out = layer_infer_(layer, in, dead);
+      return network_.infer_(out, ReleasesOutput<First>());
+    }
+
+    template <class Teacher, class Dead, int... Dims>
+    float loss_(const ndarrayPtr<float, Dims...>& in, const Teacher& teacher,
+                Dead dead) {
+      auto out = train_forward_(layer, in, dead);
+      return network_.loss_(out, teacher, ReleasesOutput<First>());
+    }
+
     First layer;
     Network<Others...> network_;
   };
@@ -83,19 +367,38 @@ namespace dpl {
   template <int... Dims, class... Others>
   class Network<Dropout<float, Dims...>, Others...> {
    public:
+    using layer_type = Dropout<float, Dims...>;
+    static constexpr int CLASSES = Network<Others...>::CLASSES;
+
     auto predict(const ndarrayPtr<float, Dims...>& in) {
-      auto out = layer.forward(in, false);
-      return network_.predict(out);
+      return predict_(in, std::false_type());
     }
 
     template <class Teacher>
     float loss(const ndarrayPtr<float, Dims...>& in, const Teacher& teacher) {
-      auto out = layer.forward(in, true);
-      return network_.loss(out, teacher);
+      return loss_(in, teacher, std::false_type());
+    }
+
+    auto infer(const ndarrayPtr<float, Dims...>& in) const {
+      return infer_(in, std::false_type());
     }
 
     auto backward() { return layer.backward(network_.backward()); }
 
+    template <class Teacher>
+    float forward_backward(const ndarrayPtr<float, Dims...>& in,
+                           const Teacher& teacher) {
+      const float ret = loss(in, teacher);
+      backward();
+      return ret;
+    }
+
+    template <class Teacher>
+    float gradient(const ndarrayPtr<float, Dims...>& in,
+                   const Teacher& teacher) {
+      return forward_backward(in, teacher);
+    }
+
     void set_dropout_ratio_(std::vector<float>::iterator now,
                             std::vector<float>::iterator end) {
       layer.set_dropout_ratio(*now);
@@ -109,6 +412,28 @@ namespace dpl {
     const Network<Others...>& next() const { return network_; }
 
    private:
+    template <class...>
+    friend class Network;
+
+    template <class Dead>
+    auto predict_(const ndarrayPtr<float, Dims...>& in, Dead) {
+      auto out = layer.forward(in, false);
+      return network_.predict_(out, ReleasesOutput<layer_type>());
+    }
+
+    template <class Dead>
+    auto infer_(const ndarrayPtr<float, Dims...>& in, Dead) const {
+      auto out = layer.infer(in);
+      return network_.infer_(out, ReleasesOutput<layer_type>());
+    }
+
+    template <class Teacher, class Dead>
+    float loss_(const ndarrayPtr<float, Dims...>& in, const Teacher& teacher,
+                Dead) {
+      auto out = layer.forward(in, true);
+      return network_.loss_(out, teacher, ReleasesOutput<layer_type>());
+    }
+
     Dropout<float, Dims...> layer;
     Network<Others...> network_;
   };
@@ -116,17 +441,27 @@ namespace dpl {
   template <int N, int M>
   class Network<SoftmaxWithLoss<float, N, M>> {
    public:
+    using layer_type = SoftmaxWithLoss<float, N, M>;
+    static constexpr int CLASSES = M;
+
     ndarrayPtr<float, N, M> predict(const ndarrayPtr<float, N, M>& in) {
       auto ret = make_ndarray_ptr<float, N, M>();
       *ret = *in;
       return std::move(ret);
     }
 
-    float loss(const ndarrayPtr<float, N, M>& in,
-               const ndarrayPtr<float, N, M>& teacher) {
+    template <class Teacher>
+    float loss(const ndarrayPtr<float, N, M>& in, const Teacher& teacher) {
       return layer.forward(in, teacher);
     }
 
+    // scores, like predict
+    ndarrayPtr<float, N, M> infer(const ndarrayPtr<float, N, M>& in) const {
+      auto ret = make_ndarray_ptr<float, N, M>();
+      *ret = *in;
+      return ret;
+    }
+
     ndarrayPtr<float, N, M> backward() { return layer.backward(); };
 
     void set_dropout_ratio_(std::vector<float>::iterator now,
@@ -144,6 +479,30 @@ namespace dpl {
     }
 
    private:
+    template <class...>
+    friend class Network;
+
+    template <class Dead>
+    ndarrayPtr<float, N, M> predict_(const ndarrayPtr<float, N, M>& in, Dead) {
+      return predict(in);
+    }
+
+    // the buffer is already ours when dead
+    ndarrayPtr<float, N, M> infer_(const ndarrayPtr<float, N, M>& in,
+                                   std::true_type) const {
+      return in;
+    }
+    ndarrayPtr<float, N, M> infer_(const ndarrayPtr<float, N, M>& in,
+                                   std::false_type) const {
+      return infer(in);
+    }
+
+    template <class Teacher, class Dead>
+    float loss_(const ndarrayPtr<float, N, M>& in, const Teacher& teacher,
+                Dead) {
+      return loss(in, teacher);
+    }
+
     SoftmaxWithLoss<float, N, M> layer;
   };
 
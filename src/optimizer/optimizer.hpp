@@ -16,7 +16,7 @@ namespace dpl {
     template <class First, class... Layers>
     void update(Network<First, Layers...>& network) {
       network.getLayer().update(
-          [this](auto& a, auto& b) { *a = *(*a - *(*b * lr)); });
+          [this](auto& a, auto& b) { axpy(-lr, *b, *a); });
       update(network.next());
     }
 
@@ -0,0 +1,176 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_BITMASK_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_BITMASK_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include "random.hpp"
+#include "thread_pool.hpp"
+
+namespace dpl {
+
+  /**
+   * bitmask<SIZE>
+   *
+   * One bit per element of an activation, packed in 64 bit words; bit i
+   * lives in word i / 64 at position i % 64. Used by the Relu and Dropout
+   * layers in place of activation sized float masks.
+   */
+  template <int SIZE>
+  class bitmask {
+   public:
+    static constexpr int WORDS = (SIZE + 63) / 64;
+
+    bool test(int i) const { return words_[i >> 6] >> (i & 63) & 1; }
+    void set(int i, bool v) {
+      const std::uint64_t bit = (std::uint64_t)1 << (i & 63);
+      words_[i >> 6] = v ? words_[i >> 6] | bit : words_[i >> 6] & ~bit;
+    }
+
+    std::uint64_t* words() { return words_.data(); }
+    const std::uint64_t* words() const { return words_.data(); }
+
+    constexpr int size() const { return SIZE; }
+
+    // number of bits set
+    int count() const {
+      int ret = 0;
+      for (std::uint64_t w : words_) ret += __builtin_popcountll(w);
+      return ret;
+    }
+
+   private:
+    std::array<std::uint64_t, WORDS> words_ = {};
+  };
+
+  template <int SIZE>
+  std::ostream& operator<<(std::ostream& os, const bitmask<SIZE>& a) {
+    os << "[ ";
+    for (int i = 0; i < SIZE; i++) {
+      if (i) os << ", ";
+      os << a.test(i);
+    }
+    os << " ]";
+    return os;
+  }
+
+  template <int SIZE>
+  using bitmaskPtr = std::shared_ptr<bitmask<SIZE>>;
+
+  template <int SIZE>
+  bitmaskPtr<SIZE> make_bitmask_ptr() {
+    return std::make_shared<bitmask<SIZE>>();
+  }
+
+  // bit words handled together by one parallel_for chunk
+  constexpr int BITMASK_GRAIN = 1 << 9;
+
+  /**
+   * relu forward : out[i] = max(in[i], 0), mask bit i = in[i] > 0
+   * in and out may be the same buffer.
+   */
+  template <typename Type, int SIZE>
+  void relu_forward(const Type* in, Type* out, bitmask<SIZE>& mask) {
+    std::uint64_t* words = mask.words();
+    parallel_for(0, bitmask<SIZE>::WORDS, [=](int lo, int hi) {
+      for (int w = lo; w < hi; w++) {
+        const int base = w * 64;
+        if (base + 64 > SIZE) {
+          std::uint64_t bits = 0;
+          for (int b = 0; b < SIZE - base; b++) {
+            const Type v = in[base + b];
+            bits |= (std::uint64_t)(v > 0) << b;
+            out[base + b] = v > 0 ? v : 0;
+          }
+          words[w] = bits;
+          continue;
+        }
+        // 32 element halves through a local tile : 32 bit per lane shifts
+        // and no aliasing between in and out, so the loops vectorize
+        std::uint64_t bits = 0;
+        for (int h = 0; h < 2; h++) {
+          Type tile[32];
+          std::copy(in + base + 32 * h, in + base + 32 * h + 32, tile);
+          std::uint32_t half = 0;
+          for (int b = 0; b < 32; b++)
+            half |= (std::uint32_t)(tile[b] > 0) << b;
+          for (int b = 0; b < 32; b++) tile[b] = tile[b] > 0 ? tile[b] : 0;
+          std::copy(tile, tile + 32, out + base + 32 * h);
+          bits |= (std::uint64_t)half << (32 * h);
+        }
+        words[w] = bits;
+      }
+    }, BITMASK_GRAIN);
+  }
+
+  /**
+   * out[i] = mask bit i ? in[i] : 0
+   * Relu backward, Dropout forward and backward. in and out may be the
+   * same buffer.
+   */
+  template <typename Type, int SIZE>
+  void masked_copy(const Type* in, const bitmask<SIZE>& mask, Type* out) {
+    const std::uint64_t* words = mask.words();
+    parallel_for(0, bitmask<SIZE>::WORDS, [=](int lo, int hi) {
+      for (int w = lo; w < hi; w++) {
+        const int base = w * 64;
+        if (base + 64 > SIZE) {
+          for (int b = 0; b < SIZE - base; b++)
+            out[base + b] = words[w] >> b & 1 ? in[base + b] : 0;
+          continue;
+        }
+        // same 32 element tiles as relu_forward
+        for (int h = 0; h < 2; h++) {
+          const std::uint32_t bits = (std::uint32_t)(words[w] >> (32 * h));
+          Type tile[32];
+          std::copy(in + base + 32 * h, in + base + 32 * h + 32, tile);
+          for (int b = 0; b < 32; b++) tile[b] = bits >> b & 1 ? tile[b] : 0;
+          std::copy(tile, tile + 32, out + base + 32 * h);
+        }
+      }
+    }, BITMASK_GRAIN);
+  }
+
+  /**
+   * dropout mask : bit i = uniform_float(v_i) > ratio, v_i the next words of
+   * engine (random_engine() by default). One philox block per mask word,
+   * compared as integers; no float tensor in between.
+   */
+  template <int SIZE>
+  void random_keep_mask(bitmask<SIZE>& mask, float ratio,
+                        philox_engine& engine) {
+    static_assert(PHILOX_BLOCK == 64, "random_keep_mask : one block per word");
+    // uniform_float(v) > ratio  <=>  (v >> 8) > floor(ratio * 2^24)
+    const double clamped = std::min(std::max((double)ratio, 0.0), 1.0);
+    const std::uint32_t threshold = (std::uint32_t)(clamped * (1 << 24));
+    const std::uint64_t counter = engine.reserve(bitmask<SIZE>::WORDS);
+    const std::uint64_t key = engine.key(), stream = engine.stream();
+    std::uint64_t* words = mask.words();
+    parallel_for(0, bitmask<SIZE>::WORDS, [=](int lo, int hi) {
+      std::uint32_t bits[PHILOX_BLOCK];
+      for (int w = lo; w < hi; w++) {
+        philox4x32_block(counter + (std::uint64_t)w * (PHILOX_BLOCK / 4), key,
+                         bits, stream);
+        std::uint32_t half[2] = {0, 0};
+        for (int h = 0; h < 2; h++)
+          for (int b = 0; b < 32; b++)
+            half[h] |= (std::uint32_t)((bits[32 * h + b] >> 8) > threshold)
+                       << b;
+        std::uint64_t word = (std::uint64_t)half[1] << 32 | half[0];
+        // bits past SIZE stay clear, count() relies on it
+        if (w * 64 + 64 > SIZE)
+          word &= ((std::uint64_t)1 << (SIZE - w * 64)) - 1;
+        words[w] = word;
+      }
+    }, PHILOX_GRAIN);
+  }
+  template <int SIZE>
+  void random_keep_mask(bitmask<SIZE>& mask, float ratio) {
+    random_keep_mask(mask, ratio, random_engine());
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_BITMASK_HPP
@@ -0,0 +1,395 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_CONVOLUTION_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_CONVOLUTION_HPP
+
+#include <algorithm>
+#include <vector>
+#include "ndarray.hpp"
+#include "thread_pool.hpp"
+
+namespace dpl {
+
+  /**
+   * ConvAlgorithm
+   *
+   * Auto : Winograd for 3x3 stride 1 filters with at least
+   *        CONV_WINOGRAD_MIN_CHANNELS input and output channels, then
+   *        Direct for filters up to 3x3 whose output plane has at least
+   *        CONV_DIRECT_MIN_PLANE pixels, Im2col otherwise
+   * Im2col : im2col + gemm, col2im for the input gradient
+   * Direct : direct convolution, no im2col buffer
+   * Winograd : F(2x2, 3x3) forward, 3x3 stride 1 filters only; backward
+   *            runs the direct kernels
+   */
+  enum class ConvAlgorithm { Auto, Im2col, Direct, Winograd };
+
+  // output (input for the data gradient) channels computed together by the
+  // direct kernels; weights are packed in blocks of this many channels
+  constexpr int CONV_CHANNEL_BLOCK = 16;
+
+  // below this output plane size (OUT_H * OUT_W) gemm over im2col wins
+  constexpr int CONV_DIRECT_MIN_PLANE = 64;
+
+  // Winograd only pays off once the channel gemms dominate its transforms
+  constexpr int CONV_WINOGRAD_MIN_CHANNELS = 64;
+
+  //================================================================
+  // ConvShape<H, W, FILTER_H, FILTER_W, STRIDE, PAD>
+  // OUT_H, OUT_W : output size
+  // ox_begin(fx), ox_end(fx) : output columns whose tap fx is inside the
+  // image, ix = ox * STRIDE + fx - PAD in [0, W)
+  template <int H, int W, int FILTER_H, int FILTER_W, int STRIDE, int PAD>
+  struct ConvShape {
+    enum {
+      OUT_H = (H + 2 * PAD - FILTER_H) / STRIDE + 1,
+      OUT_W = (W + 2 * PAD - FILTER_W) / STRIDE + 1
+    };
+
+    static int ox_begin(int fx) {
+      return std::max(0, (PAD - fx + STRIDE - 1) / STRIDE);
+    }
+    static int ox_end(int fx) {
+      return std::min((int)OUT_W, (W + PAD - fx + STRIDE - 1) / STRIDE);
+    }
+  };
+  //================================================================
+
+  /**
+   * direct convolution forward
+   * y[n, k, oy, ox] = b[k] + sum_{c, fy, fx} x[n, c, iy, ix] * w[k, c, fy, fx]
+   *
+   * Weights are packed as [K / CB][C][FH][FW][CB] so the innermost loop
+   * runs over CB output channels with unit stride. One task per
+   * (n, channel block, oy) output row.
+   */
+  template <typename Type, int N, int C, int H, int W, int K, int FILTER_H,
+            int FILTER_W, int STRIDE, int PAD, int OUT_H, int OUT_W>
+  void conv2d_direct_forward(const ndarray<Type, N, C, H, W>& x,
+                             const ndarray<Type, K, C, FILTER_H, FILTER_W>& w,
+                             const ndarray<Type, K>& b,
+                             ndarray<Type, N, K, OUT_H, OUT_W>& y) {
+    using shape = ConvShape<H, W, FILTER_H, FILTER_W, STRIDE, PAD>;
+    static_assert(OUT_H == shape::OUT_H && OUT_W == shape::OUT_W,
+                  "conv2d_direct_forward : output size mismatch");
+    constexpr int CB = CONV_CHANNEL_BLOCK;
+    constexpr int KB = (K + CB - 1) / CB;
+
+    auto packed = make_ndarray_ptr<Type, KB, C, FILTER_H, FILTER_W, CB>();
+    for (int kb = 0; kb < KB; kb++)
+      for (int c = 0; c < C; c++)
+        for (int fy = 0; fy < FILTER_H; fy++)
+          for (int fx = 0; fx < FILTER_W; fx++)
+            for (int j = 0; j < CB; j++)
+              packed->at(kb, c, fy, fx, j) =
+                  kb * CB + j < K ? w.at(kb * CB + j, c, fy, fx) : 0;
+
+    const Type* px = x.data();
+    const Type* pw = packed->data();
+    Type* py = y.data();
+    parallel_for(0, N * KB * OUT_H, [&](int lo, int hi) {
+      alignas(64) Type acc[OUT_W][CB];
+      for (int r = lo; r < hi; r++) {
+        const int n = r / (KB * OUT_H), kb = r / OUT_H % KB, oy = r % OUT_H;
+        const int kn = std::min(CB, K - kb * CB);
+        for (int ox = 0; ox < OUT_W; ox++)
+          for (int j = 0; j < CB; j++) acc[ox][j] = j < kn ? b[kb * CB + j] : 0;
+
+        for (int c = 0; c < C; c++)
+          for (int fy = 0; fy < FILTER_H; fy++) {
+            const int iy = oy * STRIDE + fy - PAD;
+            if (iy < 0 || iy >= H) continue;
+            const Type* row = px + ((n * C + c) * H + iy) * W;
+            for (int fx = 0; fx < FILTER_W; fx++) {
+              const Type* wv =
+                  pw + (((kb * C + c) * FILTER_H + fy) * FILTER_W + fx) * CB;
+              const int end = shape::ox_end(fx);
+              for (int ox = shape::ox_begin(fx); ox < end; ox++) {
+                const Type v = row[ox * STRIDE + fx - PAD];
+                for (int j = 0; j < CB; j++) acc[ox][j] += v * wv[j];
+              }
+            }
+          }
+
+        for (int j = 0; j < kn; j++) {
+          Type* out = py + ((n * K + kb * CB + j) * OUT_H + oy) * OUT_W;
+          for (int ox = 0; ox < OUT_W; ox++) out[ox] = acc[ox][j];
+        }
+      }
+    });
+  }
+
+  /**
+   * direct convolution, gradient with respect to the input
+   * dx[n, c, iy, ix] = sum_{k, fy, fx} dy[n, k, oy, ox] * w[k, c, fy, fx]
+   *
+   * Weights are packed as [C / CB][K][FH][FW][CB]. One task per
+   * (n, channel block, iy) input row, which gathers every output row that
+   * reads it, so there are no write conflicts.
+   */
+  template <typename Type, int N, int C, int H, int W, int K, int FILTER_H,
+            int FILTER_W, int STRIDE, int PAD, int OUT_H, int OUT_W>
+  void conv2d_direct_backward_data(
+      const ndarray<Type, N, K, OUT_H, OUT_W>& dy,
+      const ndarray<Type, K, C, FILTER_H, FILTER_W>& w,
+      ndarray<Type, N, C, H, W>& dx) {
+    using shape = ConvShape<H, W, FILTER_H, FILTER_W, STRIDE, PAD>;
+    static_assert(OUT_H == shape::OUT_H && OUT_W == shape::OUT_W,
+                  "conv2d_direct_backward_data : output size mismatch");
+    constexpr int CB = CONV_CHANNEL_BLOCK;
+    constexpr int CBN = (C + CB - 1) / CB;
+
+    auto packed = make_ndarray_ptr<Type, CBN, K, FILTER_H, FILTER_W, CB>();
+    for (int cb = 0; cb < CBN; cb++)
+      for (int k = 0; k < K; k++)
+        for (int fy = 0; fy < FILTER_H; fy++)
+          for (int fx = 0; fx < FILTER_W; fx++)
+            for (int j = 0; j < CB; j++)
+              packed->at(cb, k, fy, fx, j) =
+                  cb * CB + j < C ? w.at(k, cb * CB + j, fy, fx) : 0;
+
+    const Type* pdy = dy.data();
+    const Type* pw = packed->data();
+    Type* pdx = dx.data();
+    parallel_for(0, N * CBN * H, [&](int lo, int hi) {
+      alignas(64) Type acc[W][CB];
+      for (int r = lo; r < hi; r++) {
+        const int n = r / (CBN * H), cb = r / H % CBN, iy = r % H;
+        const int cn = std::min(CB, C - cb * CB);
+        for (int ix = 0; ix < W; ix++)
+          for (int j = 0; j < CB; j++) acc[ix][j] = 0;
+
+        for (int k = 0; k < K; k++)
+          for (int fy = 0; fy < FILTER_H; fy++) {
+            const int t = iy + PAD - fy;
+            if (t < 0 || t % STRIDE || t / STRIDE >= OUT_H) continue;
+            const Type* g = pdy + ((n * K + k) * OUT_H + t / STRIDE) * OUT_W;
+            for (int fx = 0; fx < FILTER_W; fx++) {
+              const Type* wv =
+                  pw + (((cb * K + k) * FILTER_H + fy) * FILTER_W + fx) * CB;
+              const int end = shape::ox_end(fx);
+              for (int ox = shape::ox_begin(fx); ox < end; ox++) {
+                const Type v = g[ox];
+                Type* a = acc[ox * STRIDE + fx - PAD];
+                for (int j = 0; j < CB; j++) a[j] += v * wv[j];
+              }
+            }
+          }
+
+        for (int j = 0; j < cn; j++) {
+          Type* out = pdx + ((n * C + cb * CB + j) * H + iy) * W;
+          for (int ix = 0; ix < W; ix++) out[ix] = acc[ix][j];
+        }
+      }
+    });
+  }
+
+  /**
+   * direct convolution, gradients with respect to the filter and the bias
+   * dw[k, c, fy, fx] = sum_{n, oy, ox} dy[n, k, oy, ox] * x[n, c, iy, ix]
+   * db[k] = sum_{n, oy, ox} dy[n, k, oy, ox]
+   *
+   * dy is first transposed to [N][OUT_H][OUT_W][K] so that the innermost
+   * loop runs over output channels; every task owns one input channel.
+   */
+  template <typename Type, int N, int C, int H, int W, int K, int FILTER_H,
+            int FILTER_W, int STRIDE, int PAD, int OUT_H, int OUT_W>
+  void conv2d_direct_backward_filter(
+      const ndarray<Type, N, C, H, W>& x,
+      const ndarray<Type, N, K, OUT_H, OUT_W>& dy,
+      ndarray<Type, K, C, FILTER_H, FILTER_W>& dw, ndarray<Type, K>& db) {
+    using shape = ConvShape<H, W, FILTER_H, FILTER_W, STRIDE, PAD>;
+    static_assert(OUT_H == shape::OUT_H && OUT_W == shape::OUT_W,
+                  "conv2d_direct_backward_filter : output size mismatch");
+
+    auto dyt = dy.view().template transpose<0, 2, 3, 1>().copy();
+    const Type* px = x.data();
+    const Type* pdy = dy.data();
+    const Type* pg = dyt->data();
+
+    parallel_for(0, K, [&](int lo, int hi) {
+      for (int k = lo; k < hi; k++) {
+        Type sum = 0;
+        for (int n = 0; n < N; n++) {
+          const Type* g = pdy + (n * K + k) * OUT_H * OUT_W;
+          for (int i = 0; i < OUT_H * OUT_W; i++) sum += g[i];
+        }
+        db[k] = sum;
+      }
+    });
+
+    parallel_for(0, C, [&](int lo, int hi) {
+      alignas(64) Type acc[FILTER_H * FILTER_W][K];
+      for (int c = lo; c < hi; c++) {
+        for (int f = 0; f < FILTER_H * FILTER_W; f++)
+          for (int k = 0; k < K; k++) acc[f][k] = 0;
+        for (int n = 0; n < N; n++) {
+          const Type* img = px + (n * C + c) * H * W;
+          for (int oy = 0; oy < OUT_H; oy++)
+            for (int fy = 0; fy < FILTER_H; fy++) {
+              const int iy = oy * STRIDE + fy - PAD;
+              if (iy < 0 || iy >= H) continue;
+              for (int fx = 0; fx < FILTER_W; fx++) {
+                Type* a = acc[fy * FILTER_W + fx];
+                const int end = shape::ox_end(fx);
+                for (int ox = shape::ox_begin(fx); ox < end; ox++) {
+                  const Type v = img[iy * W + ox * STRIDE + fx - PAD];
+                  const Type* g = pg + ((n * OUT_H + oy) * OUT_W + ox) * K;
+                  for (int k = 0; k < K; k++) a[k] += v * g[k];
+                }
+              }
+            }
+        }
+        for (int k = 0; k < K; k++)
+          for (int f = 0; f < FILTER_H * FILTER_W; f++)
+            dw.at(k, c).data()[f] = acc[f][k];
+      }
+    });
+  }
+
+  // minimum number of tiles batched into one Winograd gemm
+  constexpr int WINOGRAD_MIN_TILES = 512;
+
+  //================================================================
+  // WinogradShape<OUT_H, OUT_W> : F(2x2, 3x3) tiling of the output
+  // TILE_H, TILE_W : 2x2 output tiles per image
+  // TILES : TILE_H * TILE_W
+  template <int OUT_H, int OUT_W>
+  struct WinogradShape {
+    enum {
+      TILE_H = (OUT_H + 1) / 2,
+      TILE_W = (OUT_W + 1) / 2,
+      TILES = TILE_H * TILE_W
+    };
+  };
+  //================================================================
+
+  /**
+   * Winograd F(2x2, 3x3) filter transform, U = G g G^T
+   * u[xi][k][c] is element xi of the 4x4 transform of w[k][c]
+   *
+   *     | 1    0    0   |
+   * G = | 1/2  1/2  1/2 |
+   *     | 1/2 -1/2  1/2 |
+   *     | 0    0    1   |
+   */
+  template <typename Type, int K, int C>
+  void winograd_filter_transform(const ndarray<Type, K, C, 3, 3>& w,
+                                 ndarray<Type, 16, K, C>& u) {
+    const Type* pw = w.data();
+    Type* pu = u.data();
+    parallel_for(0, K * C, [&](int lo, int hi) {
+      for (int kc = lo; kc < hi; kc++) {
+        const Type* g = pw + kc * 9;
+        Type t[4][3], v[4][4];
+        for (int j = 0; j < 3; j++) {
+          t[0][j] = g[j];
+          t[1][j] = (g[j] + g[3 + j] + g[6 + j]) * (Type)0.5;
+          t[2][j] = (g[j] - g[3 + j] + g[6 + j]) * (Type)0.5;
+          t[3][j] = g[6 + j];
+        }
+        for (int i = 0; i < 4; i++) {
+          v[i][0] = t[i][0];
+          v[i][1] = (t[i][0] + t[i][1] + t[i][2]) * (Type)0.5;
+          v[i][2] = (t[i][0] - t[i][1] + t[i][2]) * (Type)0.5;
+          v[i][3] = t[i][2];
+        }
+        for (int xi = 0; xi < 16; xi++) pu[xi * K * C + kc] = v[xi / 4][xi % 4];
+      }
+    });
+  }
+
+  /**
+   * Winograd F(2x2, 3x3) forward, 3x3 filter, stride 1
+   * u : filter transform from winograd_filter_transform
+   *
+   * Images are taken in groups of G (G * TILES >= WINOGRAD_MIN_TILES).
+   * Every 4x4 input tile d of a group is transformed to V = B^T d B and
+   * scattered to [16][C][G * TILES]; the 16 products M = U * V are
+   * K x C by C x (G * TILES) gemms, and Y = A^T M A gives the 2x2 output
+   * tile.
+   *
+   *       | 1  0 -1  0 |
+   * B^T = | 0  1  1  0 |      A^T = | 1  1  1  0 |
+   *       | 0 -1  1  0 |            | 0  1 -1 -1 |
+   *       | 0  1  0 -1 |
+   */
+  template <typename Type, int N, int C, int H, int W, int K, int PAD,
+            int OUT_H, int OUT_W>
+  void conv2d_winograd_forward(const ndarray<Type, N, C, H, W>& x,
+                               const ndarray<Type, 16, K, C>& u,
+                               const ndarray<Type, K>& b,
+                               ndarray<Type, N, K, OUT_H, OUT_W>& y) {
+    using shape = ConvShape<H, W, 3, 3, 1, PAD>;
+    static_assert(OUT_H == shape::OUT_H && OUT_W == shape::OUT_W,
+                  "conv2d_winograd_forward : output size mismatch");
+    using tiling = WinogradShape<OUT_H, OUT_W>;
+    constexpr int TW = tiling::TILE_W;
+    constexpr int T = tiling::TILES;
+
+    // images per gemm, so that the gemm width G * T is not too small
+    constexpr int G = std::min(N, (WINOGRAD_MIN_TILES + T - 1) / T);
+    constexpr int GT = G * T;
+
+    const Type* px = x.data();
+    const Type* pu = u.data();
+    Type* py = y.data();
+    parallel_for(0, (N + G - 1) / G, [&](int lo, int hi) {
+      std::vector<Type> v(16 * C * GT), m(16 * K * GT);
+      for (int grp = lo; grp < hi; grp++) {
+        const int n0 = grp * G, gn = std::min(G, N - n0), gt = gn * T;
+        for (int c = 0; c < C; c++)
+          for (int t = 0; t < gt; t++) {
+            const Type* img = px + ((n0 + t / T) * C + c) * H * W;
+            const int y0 = t % T / TW * 2 - PAD, x0 = t % TW * 2 - PAD;
+            Type d[4][4], r[4][4];
+            for (int i = 0; i < 4; i++)
+              for (int j = 0; j < 4; j++) {
+                const int iy = y0 + i, ix = x0 + j;
+                d[i][j] = iy >= 0 && iy < H && ix >= 0 && ix < W
+                              ? img[iy * W + ix]
+                              : 0;
+              }
+            for (int j = 0; j < 4; j++) {
+              r[0][j] = d[0][j] - d[2][j];
+              r[1][j] = d[1][j] + d[2][j];
+              r[2][j] = d[2][j] - d[1][j];
+              r[3][j] = d[1][j] - d[3][j];
+            }
+            Type* dst = v.data() + c * gt + t;
+            for (int i = 0; i < 4; i++) {
+              dst[(i * 4 + 0) * C * gt] = r[i][0] - r[i][2];
+              dst[(i * 4 + 1) * C * gt] = r[i][1] + r[i][2];
+              dst[(i * 4 + 2) * C * gt] = r[i][2] - r[i][1];
+              dst[(i * 4 + 3) * C * gt] = r[i][1] - r[i][3];
+            }
+          }
+
+        for (int xi = 0; xi < 16; xi++)
+          gemm(K, gt, C, pu + xi * K * C, C, 1, v.data() + xi * C * gt, gt, 1,
+               m.data() + xi * K * gt, gt);
+
+        for (int k = 0; k < K; k++)
+          for (int t = 0; t < gt; t++) {
+            Type* out = py + ((n0 + t / T) * K + k) * OUT_H * OUT_W;
+            const Type* src = m.data() + k * gt + t;
+            Type a[4][4], r[2][4];
+            for (int xi = 0; xi < 16; xi++)
+              a[xi / 4][xi % 4] = src[xi * K * gt];
+            for (int j = 0; j < 4; j++) {
+              r[0][j] = a[0][j] + a[1][j] + a[2][j];
+              r[1][j] = a[1][j] - a[2][j] - a[3][j];
+            }
+            const int oy = t % T / TW * 2, ox = t % TW * 2;
+            for (int i = 0; i < 2 && oy + i < OUT_H; i++) {
+              const Type o[2] = {r[i][0] + r[i][1] + r[i][2],
+                                 r[i][1] - r[i][2] - r[i][3]};
+              for (int j = 0; j < 2 && ox + j < OUT_W; j++)
+                out[(oy + i) * OUT_W + ox + j] = o[j] + b[k];
+            }
+          }
+      }
+    });
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_CONVOLUTION_HPP
@@ -0,0 +1,421 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_EXPRESSION_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_EXPRESSION_HPP
+
+#include <cmath>
+#include <iostream>
+#include <type_traits>
+#include "ndarray.hpp"
+
+namespace dpl {
+
+  //================================================================
+  // elementwise operations used as ndexpr<..., Op, ...>
+  struct plus_op {
+    template <typename T>
+    static T apply(const T& a, const T& b) {
+      return a + b;
+    }
+  };
+  struct minus_op {
+    template <typename T>
+    static T apply(const T& a, const T& b) {
+      return a - b;
+    }
+  };
+  struct multiplies_op {
+    template <typename T>
+    static T apply(const T& a, const T& b) {
+      return a * b;
+    }
+  };
+  struct divides_op {
+    template <typename T>
+    static T apply(const T& a, const T& b) {
+      return a / b;
+    }
+  };
+  struct maximum_op {
+    template <typename T>
+    static T apply(const T& a, const T& b) {
+      return std::max(a, b);
+    }
+  };
+  struct exp_op {
+    template <typename T>
+    static T apply(const T& a) {
+      return std::exp(a);
+    }
+  };
+  //================================================================
+
+  // scalar operand, broadcast to every element
+  template <typename Type>
+  class ndexpr_scalar {
+   public:
+    explicit ndexpr_scalar(const Type& v) : v_(v) {}
+    Type operator[](int) const { return v_; }
+
+   private:
+    Type v_;
+  };
+
+  // tensor operand, shared with the expression so that it may outlive the
+  // operand it was built from. an ndarrayPtr is shared as it is, and a
+  // plain ndarray is copied, so *a - *b keeps the values a and b had when
+  // the expression was built.
+  template <class Array>
+  class ndexpr_leaf;
+
+  template <typename Type, int... Dims>
+  class ndexpr_leaf<ndarray<Type, Dims...>> {
+   public:
+    explicit ndexpr_leaf(const ndarray<Type, Dims...>& a)
+        : ndexpr_leaf(snapshot_(a)) {}
+    explicit ndexpr_leaf(const ndarrayPtr<Type, Dims...>& p)
+        : p_(p), data_(p->data()) {}
+    Type operator[](int i) const { return data_[i]; }
+
+   private:
+    static ndarrayPtr<Type, Dims...> snapshot_(
+        const ndarray<Type, Dims...>& a) {
+      auto ret = make_ndarray_ptr<Type, Dims...>();
+      *ret = a;
+      return ret;
+    }
+
+    std::shared_ptr<const ndarray<Type, Dims...>> p_;
+    const Type* data_;
+  };
+
+  //================================================================
+  // ExprTraits<T>
+  // is_expr : T can be a tensor operand of an elementwise expression
+  // result_type : ndarray<Type, Dims...> the operand evaluates to
+  // storage : how an ndexpr keeps T. ndarrays and ndarrayPtrs become
+  // ndexpr_leaf and nodes are held by value, so an expression owns
+  // everything it reads and can be kept in an auto variable.
+  template <class T>
+  struct ExprTraits {
+    static constexpr bool is_expr = false;
+  };
+
+  template <typename Type, int... Dims>
+  struct ExprTraits<ndarray<Type, Dims...>> {
+    static constexpr bool is_expr = true;
+    using result_type = ndarray<Type, Dims...>;
+    using storage = const ndexpr_leaf<ndarray<Type, Dims...>>;
+  };
+
+  template <typename Type, int... Dims>
+  struct ExprTraits<std::shared_ptr<ndarray<Type, Dims...>>> {
+    static constexpr bool is_expr = true;
+    using result_type = ndarray<Type, Dims...>;
+    using storage = const ndexpr_leaf<ndarray<Type, Dims...>>;
+  };
+
+  template <class Result, class Op, class L, class R>
+  struct ExprTraits<ndexpr<Result, Op, L, R>> {
+    static constexpr bool is_expr = true;
+    using result_type = Result;
+    using storage = const ndexpr<Result, Op, L, R>;
+  };
+
+  template <typename Type>
+  struct ExprTraits<ndexpr_scalar<Type>> {
+    static constexpr bool is_expr = false;
+    using storage = const ndexpr_scalar<Type>;
+  };
+
+  // ndarray type of L op R, for tensor operands of the same shape
+  template <class L, class R>
+  using ExprResult = std::enable_if_t<
+      ExprTraits<L>::is_expr && ExprTraits<R>::is_expr &&
+          std::is_same<typename ExprTraits<L>::result_type,
+                       typename ExprTraits<R>::result_type>::value,
+      typename ExprTraits<L>::result_type>;
+
+  // ndarray type of L op v, for a tensor operand and a scalar
+  template <class L, class V>
+  using ExprScalarResult =
+      std::enable_if_t<ExprTraits<L>::is_expr && std::is_arithmetic<V>::value,
+                       typename ExprTraits<L>::result_type>;
+  //================================================================
+
+  /**
+   * ndexpr_base
+   *
+   * Common part of every elementwise expression node. Elements are computed
+   * on demand by operator[], so assigning an expression to an ndarray runs
+   * one fused loop without temporaries.
+   */
+  template <class Derived, class Result>
+  class ndexpr_base;
+
+  template <class Derived, typename Type, int... Dims>
+  class ndexpr_base<Derived, ndarray<Type, Dims...>> {
+   public:
+    using value_type = Type;
+    using result_type = ndarray<Type, Dims...>;
+
+    constexpr size_t size() const {
+      return GetFact<sizeof...(Dims) - 1, Dims...>::value;
+    }
+
+    // operators used to return ndarrayPtr which callers dereferenced, as in
+    // *(*a - *(*b * lr)); an expression is its own value
+    const Derived& operator*() const {
+      return static_cast<const Derived&>(*this);
+    }
+
+    // evaluate into a newly allocated ndarray
+    ndarrayPtr<Type, Dims...> eval() const {
+      auto ret = make_ndarray_ptr<Type, Dims...>();
+      *ret = static_cast<const Derived&>(*this);
+      return ret;
+    }
+    operator ndarrayPtr<Type, Dims...>() const { return eval(); }
+  };
+
+  template <class Result, class Op, class L, class R>
+  class ndexpr : public ndexpr_base<ndexpr<Result, Op, L, R>, Result> {
+   public:
+    ndexpr(const L& l, const R& r) : l_(l), r_(r) {}
+
+    auto operator[](int i) const { return Op::apply(l_[i], r_[i]); }
+
+   private:
+    typename ExprTraits<L>::storage l_;
+    typename ExprTraits<R>::storage r_;
+  };
+
+  template <class Result, class Op, class L>
+  class ndexpr<Result, Op, L, void>
+      : public ndexpr_base<ndexpr<Result, Op, L, void>, Result> {
+   public:
+    explicit ndexpr(const L& l) : l_(l) {}
+
+    auto operator[](int i) const { return Op::apply(l_[i]); }
+
+   private:
+    typename ExprTraits<L>::storage l_;
+  };
+
+  //================================================================
+  // elementwise operators : tensor op tensor, tensor op scalar
+  template <class L, class R, class Res = ExprResult<L, R>>
+  ndexpr<Res, plus_op, L, R> operator+(const L& a, const R& b) {
+    return ndexpr<Res, plus_op, L, R>(a, b);
+  }
+
+  template <class L, class V, class Res = ExprScalarResult<L, V>>
+  auto operator+(const L& a, const V& v) {
+    using S = ndexpr_scalar<typename Res::value_type>;
+    return ndexpr<Res, plus_op, L, S>(a, S(v));
+  }
+
+  template <class L, class R, class Res = ExprResult<L, R>>
+  ndexpr<Res, minus_op, L, R> operator-(const L& a, const R& b) {
+    return ndexpr<Res, minus_op, L, R>(a, b);
+  }
+
+  template <class L, class V, class Res = ExprScalarResult<L, V>>
+  auto operator-(const L& a, const V& v) {
+    using S = ndexpr_scalar<typename Res::value_type>;
+    return ndexpr<Res, minus_op, L, S>(a, S(v));
+  }
+
+  template <class L, class R, class Res = ExprResult<L, R>>
+  ndexpr<Res, multiplies_op, L, R> operator*(const L& a, const R& b) {
+    return ndexpr<Res, multiplies_op, L, R>(a, b);
+  }
+
+  template <class L, class V, class Res = ExprScalarResult<L, V>>
+  auto operator*(const L& a, const V& v) {
+    using S = ndexpr_scalar<typename Res::value_type>;
+    return ndexpr<Res, multiplies_op, L, S>(a, S(v));
+  }
+
+  template <class L, class R, class Res = ExprResult<L, R>>
+  ndexpr<Res, divides_op, L, R> operator/(const L& a, const R& b) {
+    return ndexpr<Res, divides_op, L, R>(a, b);
+  }
+
+  template <class L, class V, class Res = ExprScalarResult<L, V>>
+  auto operator/(const L& a, const V& v) {
+    using S = ndexpr_scalar<typename Res::value_type>;
+    return ndexpr<Res, divides_op, L, S>(a, S(v));
+  }
+
+  template <class L, class R, class Res = ExprResult<L, R>>
+  ndexpr<Res, maximum_op, L, R> maximum(const L& a, const R& b) {
+    return ndexpr<Res, maximum_op, L, R>(a, b);
+  }
+
+  template <class L, class Res = typename ExprTraits<L>::result_type>
+  ndexpr<Res, exp_op, L, void> exp(const L& input) {
+    return ndexpr<Res, exp_op, L, void>(input);
+  }
+  //================================================================
+
+  //================================================================
+  // compound assignment : evaluate the right hand side straight into the
+  // destination, a op= tensor or a op= scalar. the right hand side is read
+  // in place, an ndarray operand is not copied.
+  template <class E>
+  const E& operand_(const E& e) {
+    return e;
+  }
+
+  template <typename Type, int... Dims>
+  const ndarray<Type, Dims...>& operand_(const ndarrayPtr<Type, Dims...>& p) {
+    return *p;
+  }
+
+  template <class Op, typename Type, int... Dims, class E>
+  ndarray<Type, Dims...>& compound_assign_(ndarray<Type, Dims...>& a,
+                                           const E& rhs) {
+    const auto& e = operand_(rhs);
+    Type* p = a.data();
+    parallel_for(0, a.size(), [p, &e](int lo, int hi) {
+      for (int i = lo; i < hi; i++) p[i] = Op::apply(p[i], (Type)e[i]);
+    }, PARALLEL_GRAIN);
+    return a;
+  }
+
+  template <typename Type, int... Dims, class E>
+  ExprResult<ndarray<Type, Dims...>, E>& operator+=(ndarray<Type, Dims...>& a,
+                                                    const E& e) {
+    return compound_assign_<plus_op>(a, e);
+  }
+
+  template <typename Type, int... Dims, class V>
+  ExprScalarResult<ndarray<Type, Dims...>, V>& operator+=(
+      ndarray<Type, Dims...>& a, const V& v) {
+    return compound_assign_<plus_op>(a, ndexpr_scalar<Type>(v));
+  }
+
+  template <typename Type, int... Dims, class E>
+  ExprResult<ndarray<Type, Dims...>, E>& operator-=(ndarray<Type, Dims...>& a,
+                                                    const E& e) {
+    return compound_assign_<minus_op>(a, e);
+  }
+
+  template <typename Type, int... Dims, class V>
+  ExprScalarResult<ndarray<Type, Dims...>, V>& operator-=(
+      ndarray<Type, Dims...>& a, const V& v) {
+    return compound_assign_<minus_op>(a, ndexpr_scalar<Type>(v));
+  }
+
+  template <typename Type, int... Dims, class E>
+  ExprResult<ndarray<Type, Dims...>, E>& operator*=(ndarray<Type, Dims...>& a,
+                                                    const E& e) {
+    return compound_assign_<multiplies_op>(a, e);
+  }
+
+  template <typename Type, int... Dims, class V>
+  ExprScalarResult<ndarray<Type, Dims...>, V>& operator*=(
+      ndarray<Type, Dims...>& a, const V& v) {
+    return compound_assign_<multiplies_op>(a, ndexpr_scalar<Type>(v));
+  }
+
+  template <typename Type, int... Dims, class E>
+  ExprResult<ndarray<Type, Dims...>, E>& operator/=(ndarray<Type, Dims...>& a,
+                                                    const E& e) {
+    return compound_assign_<divides_op>(a, e);
+  }
+
+  template <typename Type, int... Dims, class V>
+  ExprScalarResult<ndarray<Type, Dims...>, V>& operator/=(
+      ndarray<Type, Dims...>& a, const V& v) {
+    return compound_assign_<divides_op>(a, ndexpr_scalar<Type>(v));
+  }
+
+  // y += alpha * x
+  template <typename Type, int... Dims, typename U>
+  ndarray<Type, Dims...>& axpy(const U& alpha, const ndarray<Type, Dims...>& x,
+                               ndarray<Type, Dims...>& y) {
+    const Type a = (Type)alpha;
+    const Type* px = x.data();
+    Type* py = y.data();
+    parallel_for(0, y.size(), [a, px, py](int lo, int hi) {
+      for (int i = lo; i < hi; i++) py[i] += a * px[i];
+    }, PARALLEL_GRAIN);
+    return y;
+  }
+  //================================================================
+
+  //================================================================
+  // broadcast along axis I : a[..., j, ...] op= v[j] where j is the index
+  // of the I-th dimension, e.g. add_along<1>(x, b) adds a bias b[K] to
+  // every row of x[N, K]
+  template <class Op, int I, typename Type, int... Dims>
+  ndarray<Type, Dims...>& along_(
+      ndarray<Type, Dims...>& a,
+      const ndarray<Type, Get<I, Dims...>::value>& v) {
+    constexpr int AXIS = Get<I, Dims...>::value;
+    constexpr int INNER = GetStride<I, Dims...>::value;
+    constexpr int OUTER = GetFact<sizeof...(Dims) - 1, Dims...>::value /
+                          (AXIS * INNER);
+    Type* data = a.data();
+    const Type* pv = v.data();
+    parallel_for(0, OUTER, [data, pv](int lo, int hi) {
+      Type* p = data + lo * AXIS * INNER;
+      for (int o = lo; o < hi; o++)
+        for (int j = 0; j < AXIS; j++, p += INNER)
+          for (int k = 0; k < INNER; k++) p[k] = Op::apply(p[k], pv[j]);
+    }, std::max(1, PARALLEL_GRAIN / (AXIS * INNER)));
+    return a;
+  }
+
+  template <int I, typename Type, int... Dims>
+  ndarray<Type, Dims...>& add_along(
+      ndarray<Type, Dims...>& a,
+      const ndarray<Type, Get<I, Dims...>::value>& v) {
+    return along_<plus_op, I>(a, v);
+  }
+
+  template <int I, typename Type, int... Dims>
+  ndarray<Type, Dims...>& sub_along(
+      ndarray<Type, Dims...>& a,
+      const ndarray<Type, Get<I, Dims...>::value>& v) {
+    return along_<minus_op, I>(a, v);
+  }
+
+  template <int I, typename Type, int... Dims>
+  ndarray<Type, Dims...>& mul_along(
+      ndarray<Type, Dims...>& a,
+      const ndarray<Type, Get<I, Dims...>::value>& v) {
+    return along_<multiplies_op, I>(a, v);
+  }
+
+  template <int I, typename Type, int... Dims>
+  ndarray<Type, Dims...>& div_along(
+      ndarray<Type, Dims...>& a,
+      const ndarray<Type, Get<I, Dims...>::value>& v) {
+    return along_<divides_op, I>(a, v);
+  }
+  //================================================================
+
+  template <typename Type, int... Dims, class Op, class L, class R>
+  bool operator==(const ndarray<Type, Dims...>& a,
+                  const ndexpr<ndarray<Type, Dims...>, Op, L, R>& e) {
+    for (int i = 0; i < (int)a.size(); i++)
+      if (!(a[i] == e[i])) return false;
+    return true;
+  }
+
+  template <typename Type, int... Dims, class Op, class L, class R>
+  bool operator==(const ndexpr<ndarray<Type, Dims...>, Op, L, R>& e,
+                  const ndarray<Type, Dims...>& a) {
+    return a == e;
+  }
+
+  template <class Result, class Op, class L, class R>
+  std::ostream& operator<<(std::ostream& os,
+                           const ndexpr<Result, Op, L, R>& e) {
+    return os << *e.eval();
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_EXPRESSION_HPP
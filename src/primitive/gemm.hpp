@@ -0,0 +1,343 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_GEMM_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_GEMM_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include "thread_pool.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__)) && !defined(DPL_GEMM_PORTABLE)
+#define DPL_GEMM_X86 1
+#include <immintrin.h>
+#endif
+
+namespace dpl {
+
+  /**
+   * GemmKernel
+   *
+   * Microkernel used by gemm for float. By default the widest kernel the
+   * running CPU supports is picked once; building with -DDPL_GEMM_PORTABLE
+   * compiles only the portable kernel.
+   */
+  enum class GemmKernel { Auto, Portable, Avx2, Avx512 };
+
+  //================================================================
+  // GemmBlocking<Kernel>
+  // MR x NR : register tile computed by the microkernel
+  // MC, KC, NC : cache blocks of A (MC x KC, L2) and B (KC x NC, L3)
+  template <GemmKernel Kernel>
+  struct GemmBlocking;
+
+  template <>
+  struct GemmBlocking<GemmKernel::Portable> {
+    enum { MR = 4, NR = 8, MC = 128, KC = 256, NC = 2048 };
+  };
+
+  template <>
+  struct GemmBlocking<GemmKernel::Avx2> {
+    enum { MR = 6, NR = 16, MC = 144, KC = 256, NC = 3072 };
+  };
+
+  template <>
+  struct GemmBlocking<GemmKernel::Avx512> {
+    enum { MR = 12, NR = 32, MC = 144, KC = 384, NC = 3072 };
+  };
+  //================================================================
+
+  // thread local scratch for the packed blocks, grown on demand
+  template <typename Type>
+  class gemm_buffer_ {
+   public:
+    Type* get(std::size_t n) {
+      if (n > size_) {
+        p_.reset(static_cast<Type*>(
+            ::operator new(n * sizeof(Type), std::align_val_t(64))));
+        size_ = n;
+      }
+      return p_.get();
+    }
+
+   private:
+    struct deleter_ {
+      void operator()(Type* p) const {
+        ::operator delete(p, std::align_val_t(64));
+      }
+    };
+    std::unique_ptr<Type, deleter_> p_;
+    std::size_t size_ = 0;
+  };
+
+  // pack rows [0, mc) x cols [0, kc) of A(i, p) = a[i * rs + p * cs] into
+  // MR-row panels, each stored column by column and zero padded
+  template <int MR, typename Type>
+  void gemm_pack_a_(int mc, int kc, const Type* a, int rs, int cs, Type* dst) {
+    for (int i = 0; i < mc; i += MR) {
+      const int mr = std::min(MR, mc - i);
+      for (int p = 0; p < kc; p++, dst += MR) {
+        const Type* src = a + i * rs + p * cs;
+        for (int r = 0; r < mr; r++) dst[r] = src[r * rs];
+        for (int r = mr; r < MR; r++) dst[r] = 0;
+      }
+    }
+  }
+
+  // pack rows [0, kc) x cols [0, nc) of B(p, j) = b[p * rs + j * cs] into
+  // NR-column panels, each stored row by row and zero padded
+  template <int NR, typename Type>
+  void gemm_pack_b_(int kc, int nc, const Type* b, int rs, int cs, Type* dst) {
+    for (int j = 0; j < nc; j += NR) {
+      const int nr = std::min(NR, nc - j);
+      for (int p = 0; p < kc; p++, dst += NR) {
+        const Type* src = b + p * rs + j * cs;
+        if (cs == 1)
+          std::copy(src, src + nr, dst);
+        else
+          for (int r = 0; r < nr; r++) dst[r] = src[r * cs];
+        for (int r = nr; r < NR; r++) dst[r] = 0;
+      }
+    }
+  }
+
+  //================================================================
+  // microkernels : c[MR x NR] (+)= packed a panel * packed b panel
+  // c is row-major with leading dimension ldc, load_c selects +=
+  template <typename Type>
+  void gemm_kernel_portable_(int kc, const Type* a, const Type* b, Type* c,
+                             int ldc, bool load_c) {
+    constexpr int MR = GemmBlocking<GemmKernel::Portable>::MR;
+    constexpr int NR = GemmBlocking<GemmKernel::Portable>::NR;
+    Type acc[MR][NR] = {};
+    for (int p = 0; p < kc; p++, a += MR, b += NR)
+      for (int i = 0; i < MR; i++)
+        for (int j = 0; j < NR; j++) acc[i][j] += a[i] * b[j];
+    for (int i = 0; i < MR; i++)
+      for (int j = 0; j < NR; j++)
+        c[i * ldc + j] = (load_c ? c[i * ldc + j] : 0) + acc[i][j];
+  }
+
+#ifdef DPL_GEMM_X86
+  __attribute__((target("avx2,fma"))) inline void gemm_kernel_avx2_(
+      int kc, const float* a, const float* b, float* c, int ldc, bool load_c) {
+    __m256 acc[6][2];
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++)
+      acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+    for (int p = 0; p < kc; p++, a += 6, b += 16) {
+      const __m256 b0 = _mm256_loadu_ps(b);
+      const __m256 b1 = _mm256_loadu_ps(b + 8);
+#pragma GCC unroll 6
+      for (int i = 0; i < 6; i++) {
+        const __m256 ai = _mm256_broadcast_ss(a + i);
+        acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+      }
+    }
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++, c += ldc) {
+      if (load_c) {
+        acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(c));
+        acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(c + 8));
+      }
+      _mm256_storeu_ps(c, acc[i][0]);
+      _mm256_storeu_ps(c + 8, acc[i][1]);
+    }
+  }
+
+  __attribute__((target("avx512f"))) inline void gemm_kernel_avx512_(
+      int kc, const float* a, const float* b, float* c, int ldc, bool load_c) {
+    __m512 acc[12][2];
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++)
+      acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+    for (int p = 0; p < kc; p++, a += 12, b += 32) {
+      const __m512 b0 = _mm512_loadu_ps(b);
+      const __m512 b1 = _mm512_loadu_ps(b + 16);
+#pragma GCC unroll 12
+      for (int i = 0; i < 12; i++) {
+        const __m512 ai = _mm512_set1_ps(a[i]);
+        acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+      }
+    }
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++, c += ldc) {
+      if (load_c) {
+        acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(c));
+        acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(c + 16));
+      }
+      _mm512_storeu_ps(c, acc[i][0]);
+      _mm512_storeu_ps(c + 16, acc[i][1]);
+    }
+  }
+#endif
+  //================================================================
+
+  template <GemmKernel Kernel, typename Type>
+  void gemm_microkernel_(int kc, const Type* a, const Type* b, Type* c,
+                         int ldc, bool load_c) {
+#ifdef DPL_GEMM_X86
+    if constexpr (Kernel == GemmKernel::Avx2)
+      gemm_kernel_avx2_(kc, a, b, c, ldc, load_c);
+    else if constexpr (Kernel == GemmKernel::Avx512)
+      gemm_kernel_avx512_(kc, a, b, c, ldc, load_c);
+    else
+#endif
+      gemm_kernel_portable_(kc, a, b, c, ldc, load_c);
+  }
+
+  // blocked driver: loops over NC, KC and MC blocks and MR x NR tiles.
+  // Each KC x NC block of B is packed once and shared; the MC row blocks
+  // (split further into groups of NR panels when there are fewer blocks
+  // than threads) run in parallel, each packing its own block of A.
+  template <GemmKernel Kernel, typename Type>
+  void gemm_blocked_(int M, int N, int K, const Type* a, int rsa, int csa,
+                     const Type* b, int rsb, int csb, Type* c, int ldc,
+                     bool accumulate) {
+    using blocking = GemmBlocking<Kernel>;
+    constexpr int MR = blocking::MR, NR = blocking::NR;
+    constexpr int MC = blocking::MC, KC = blocking::KC, NC = blocking::NC;
+
+    // B is read by every thread, so it is not kept in thread local storage
+    // that a nested gemm on this thread could overwrite
+    gemm_buffer_<Type> b_buffer;
+    const int kc_max = std::min(K, (int)KC);
+    Type* pb = b_buffer.get((std::size_t)kc_max *
+                            ((std::min(N, (int)NC) + NR - 1) / NR * NR));
+
+    const int blocks = (M + MC - 1) / MC;
+    for (int jc = 0; jc < N; jc += NC) {
+      const int nc = std::min((int)NC, N - jc);
+      const int panels = (nc + NR - 1) / NR;
+      const int groups =
+          std::min(panels, std::max(1, (num_threads() + blocks - 1) / blocks));
+      for (int pc = 0; pc < K; pc += KC) {
+        const int kc = std::min((int)KC, K - pc);
+        const bool load_c = accumulate || pc > 0;
+        const Type* bb = b + pc * rsb + jc * csb;
+        parallel_for(0, panels, [&](int lo, int hi) {
+          gemm_pack_b_<NR>(kc, std::min(nc, hi * NR) - lo * NR,
+                           bb + lo * NR * csb, rsb, csb, pb + lo * NR * kc);
+        }, std::max(1, 4096 / (kc * NR)));
+
+        parallel_for(0, blocks * groups, [&](int lo, int hi) {
+          thread_local gemm_buffer_<Type> a_buffer;
+          Type* pa = a_buffer.get((std::size_t)MC * KC);
+          Type edge[MR * NR];
+          for (int t = lo; t < hi; t++) {
+            const int ic = t / groups * MC;
+            const int mc = std::min((int)MC, M - ic);
+            const int g = t % groups;
+            const int jr_begin = panels * g / groups * NR;
+            const int jr_end = std::min(nc, panels * (g + 1) / groups * NR);
+            gemm_pack_a_<MR>(mc, kc, a + ic * rsa + pc * csa, rsa, csa, pa);
+            for (int jr = jr_begin; jr < jr_end; jr += NR) {
+              const int nr = std::min(NR, nc - jr);
+              for (int ir = 0; ir < mc; ir += MR) {
+                const int mr = std::min(MR, mc - ir);
+                Type* ct = c + (ic + ir) * ldc + jc + jr;
+                if (mr == MR && nr == NR) {
+                  gemm_microkernel_<Kernel>(kc, pa + ir * kc, pb + jr * kc,
+                                            ct, ldc, load_c);
+                  continue;
+                }
+                gemm_microkernel_<Kernel>(kc, pa + ir * kc, pb + jr * kc,
+                                          edge, NR, false);
+                for (int i = 0; i < mr; i++)
+                  for (int j = 0; j < nr; j++)
+                    ct[i * ldc + j] =
+                        (load_c ? ct[i * ldc + j] : 0) + edge[i * NR + j];
+              }
+            }
+          }
+        });
+      }
+    }
+  }
+
+  inline bool gemm_kernel_supported(GemmKernel kernel) {
+    switch (kernel) {
+      case GemmKernel::Auto:
+      case GemmKernel::Portable:
+        return true;
+#ifdef DPL_GEMM_X86
+      case GemmKernel::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+      case GemmKernel::Avx512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+      default:
+        return false;
+    }
+  }
+
+  // widest kernel supported by the running CPU
+  inline GemmKernel gemm_default_kernel_() {
+    if (gemm_kernel_supported(GemmKernel::Avx512)) return GemmKernel::Avx512;
+    if (gemm_kernel_supported(GemmKernel::Avx2)) return GemmKernel::Avx2;
+    return GemmKernel::Portable;
+  }
+
+  inline GemmKernel& gemm_kernel_() {
+    static GemmKernel kernel = gemm_default_kernel_();
+    return kernel;
+  }
+
+  // float kernel used by gemm
+  inline GemmKernel gemm_kernel() { return gemm_kernel_(); }
+
+  /**
+   * select the float microkernel, Auto restores the default.
+   *
+   * @return false (and keep the current kernel) if kernel is not supported
+   * by this build or CPU
+   */
+  inline bool set_gemm_kernel(GemmKernel kernel) {
+    if (!gemm_kernel_supported(kernel)) return false;
+    gemm_kernel_() =
+        kernel == GemmKernel::Auto ? gemm_default_kernel_() : kernel;
+    return true;
+  }
+
+  /**
+   * C = A * B (C += A * B if accumulate)
+   *
+   * A(i, p) = a[i * rsa + p * csa] : M x K
+   * B(p, j) = b[p * rsb + j * csb] : K x N
+   * C(i, j) = c[i * ldc + j] : M x N
+   *
+   * Row and column strides of A and B are free, so transposed operands
+   * are read in place.
+   */
+  template <typename Type>
+  void gemm(int M, int N, int K, const Type* a, int rsa, int csa,
+            const Type* b, int rsb, int csb, Type* c, int ldc,
+            bool accumulate = false) {
+    if (M <= 0 || N <= 0) return;
+    if (K <= 0) {
+      if (!accumulate)
+        for (int i = 0; i < M; i++) std::fill(c + i * ldc, c + i * ldc + N, 0);
+      return;
+    }
+    if constexpr (std::is_same<Type, float>::value) {
+      switch (gemm_kernel()) {
+        case GemmKernel::Avx512:
+          return gemm_blocked_<GemmKernel::Avx512>(
+              M, N, K, a, rsa, csa, b, rsb, csb, c, ldc, accumulate);
+        case GemmKernel::Avx2:
+          return gemm_blocked_<GemmKernel::Avx2>(
+              M, N, K, a, rsa, csa, b, rsb, csb, c, ldc, accumulate);
+        default:
+          break;
+      }
+    }
+    gemm_blocked_<GemmKernel::Portable>(M, N, K, a, rsa, csa, b, rsb, csb, c,
+                                        ldc, accumulate);
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_GEMM_HPP
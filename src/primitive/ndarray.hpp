@@ -6,17 +6,22 @@
 #define DEEP_LEARNING_FROM_SCRATCH_NDARRAY_HPP
 
 #include <array>
-#include <bitset>
 #include <complex>
+#include <cstddef>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <new>
 #include <random>
 #include <stdexcept>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
+#include "gemm.hpp"
+#include "random.hpp"
+#include "thread_pool.hpp"
 
 namespace dpl {
 
@@ -64,30 +69,151 @@ namespace dpl {
   };
   //================================================================
 
+  //================================================================
+  // GetStride
+  // I : index
+  // Ints... : Args...
+  // GetStride<I, Ints...>::value = Ints[I+1] * ... * Ints[N-1]
+  // (row-major distance between two neighbours along I-th dimension)
+  template <int I, int... Ints>
+  struct GetStride {
+    enum {
+      value = GetFact<sizeof...(Ints) - 1, Ints...>::value /
+              GetFact<I, Ints...>::value
+    };
+  };
+  //================================================================
+
+  //================================================================
+  // RowMajorStrides<Dims...>
+  // type = std::integer_sequence<int, stride of Dims[0], ..., 1>
+  template <class Is, int... Dims>
+  struct RowMajorStrides_;
+
+  template <int... Is, int... Dims>
+  struct RowMajorStrides_<std::integer_sequence<int, Is...>, Dims...> {
+    using type = std::integer_sequence<int, GetStride<Is, Dims...>::value...>;
+  };
+
+  template <int... Dims>
+  using RowMajorStrides = typename RowMajorStrides_<
+      std::make_integer_sequence<int, sizeof...(Dims)>, Dims...>::type;
+  //================================================================
+
+  template <typename Type, class Shape, class Strides>
+  class ndarray_view;
+
+  // contiguous_view<Type, Dims...> : view of a whole ndarray<Type, Dims...>
+  template <typename Type, int... Dims>
+  using contiguous_view =
+      ndarray_view<Type, std::integer_sequence<int, Dims...>,
+                   RowMajorStrides<Dims...>>;
+
+  //================================================================
+  // StridedCopy<Dims, Strides>
+  // Dims : std::integer_sequence<int, D0, D1, ...> extents to be visited
+  // Strides : std::integer_sequence<int, S0, S1, ...> source strides
+  // StridedCopy<Dims, Strides>::apply(src, dst) writes
+  // src[i0 * S0 + i1 * S1 + ...] to dst in row-major order of (i0, i1, ...)
+  // and returns dst + D0 * D1 * ...
+  template <class Dims, class Strides>
+  struct StridedCopy;
+
+  template <int D, int... Ds, int S, int... Ss>
+  struct StridedCopy<std::integer_sequence<int, D, Ds...>,
+                     std::integer_sequence<int, S, Ss...>> {
+    template <typename Type>
+    static Type* apply(const Type* src, Type* dst) {
+      for (int i = 0; i < D; i++, src += S)
+        dst = StridedCopy<std::integer_sequence<int, Ds...>,
+                          std::integer_sequence<int, Ss...>>::apply(src, dst);
+      return dst;
+    }
+  };
+
+  template <int D, int S>
+  struct StridedCopy<std::integer_sequence<int, D>,
+                     std::integer_sequence<int, S>> {
+    template <typename Type>
+    static Type* apply(const Type* src, Type* dst) {
+      for (int i = 0; i < D; i++) dst[i] = src[i * S];
+      return dst + D;
+    }
+  };
+  //================================================================
+
   template <typename Type, int... Args>
   class ndarray;
 
+  // elementwise expression evaluating to Result, see expression.hpp
+  template <class Result, class Op, class L, class R = void>
+  class ndexpr;
+
   template <typename Type, int... Args>
   using ndarrayPtr = std::shared_ptr<ndarray<Type, Args...>>;
 
+  // alignment of the element buffer allocated by make_ndarray_ptr
+  constexpr std::size_t NDARRAY_ALIGNMENT = 64;
+
+  // elementwise loops and full reductions are split over the thread pool
+  // in chunks of this many elements
+  constexpr int PARALLEL_GRAIN = 1 << 15;
+
   template <class Type, int... Args>
   ndarrayPtr<Type, Args...> make_ndarray_ptr() {
-    return std::move(std::make_shared<ndarray<Type, Args...>>());
+    using array_type = ndarray<Type, Args...>;
+    void* p = ::operator new(sizeof(array_type),
+                             std::align_val_t(NDARRAY_ALIGNMENT));
+    return ndarrayPtr<Type, Args...>(new (p) array_type, [](array_type* a) {
+      a->~array_type();
+      ::operator delete(a, std::align_val_t(NDARRAY_ALIGNMENT));
+    });
   };
 
+  //================================================================
+  // ndarray_initializer<Array>
+  // returned by ndarray << v so that `x << 1, 2, 3;` fills x in
+  // linear order.
+  template <class Array>
+  class ndarray_initializer {
+   public:
+    using value_type = typename Array::value_type;
+
+    ndarray_initializer(Array& array, const value_type& v)
+        : array_(array), ps_(1) {
+      array_.linerAt(0) = v;
+    }
+
+    ndarray_initializer& operator,(const value_type& v) {
+      if (ps_ >= array_.size()) throw initialize_ndarray_error();
+      array_.linerAt(ps_++) = v;
+      return *this;
+    }
+
+   private:
+    Array& array_;
+    size_t ps_;
+  };
+  //================================================================
+
   template <typename Type>
   class ndarray<Type> {};
 
   template <typename Type, int First>
   class ndarray<Type, First> : public std::array<Type, First> {
    public:
-    ndarray() : initialize_ps_(0) {
-      std::random_device rd;
-      mt = std::make_shared<std::mt19937>(rd());
-      score = std::make_shared<std::uniform_real_distribution<float>>(0.0, 1.0);
-    }
-    ndarray(const std::array<Type, First>& cp) : std::array<Type, First>(cp) {
-      ndarray();
+    ndarray() {}
+    ndarray(const std::array<Type, First>& cp) : std::array<Type, First>(cp) {}
+
+    // evaluate an elementwise expression in one pass, without temporaries
+    template <class Op, class L, class R>
+    ndarray<Type, First>& operator=(
+        const ndexpr<ndarray<Type, First>, Op, L, R>& e) {
+      Type* p = this->data();
+      parallel_for(0, First, [p, &e](int lo, int hi) {
+        for (int i = lo; i < hi; i++) p[i] = e[i];
+      }, PARALLEL_GRAIN);
+      return *this;
     }
 
     ndarray<Type, First>& at() { return *this; }
@@ -99,29 +225,46 @@ namespace dpl {
     Type& linerAt(int index) { return at(index); }
     const Type& linerAt(int index) const { return at(index); }
 
-    ndarray<Type, First>& rand() {
-      for (int i = 0; i < First; i++) at(i) = (*score)(*mt);
+    ndarray<Type, First>& rand() { return rand(random_engine()); }
+    ndarray<Type, First>& rand(philox_engine& engine) {
+      random_uniform(this->data(), First, engine);
       return *this;
     }
 
     Type max() const {
-      Type maxi = std::numeric_limits<Type>::min();
-      for (int i = 0; i < size(); i++) {
-        maxi = std::max(maxi, at(i));
-      }
-      return maxi;
+      const Type* p = this->data();
+      return parallel_reduce(
+          0, First, std::numeric_limits<Type>::lowest(),
+          [p](int lo, int hi) {
+            Type maxi = std::numeric_limits<Type>::lowest();
+            for (int i = lo; i < hi; i++) maxi = std::max(maxi, p[i]);
+            return maxi;
+          },
+          [](Type a, Type b) { return std::max(a, b); }, PARALLEL_GRAIN);
     }
 
     Type sum() const {
-      Type sumi = 0;
-      for (int i = 0; i < size(); i++) {
-        sumi += at(i);
-      }
-      return sumi;
+      const Type* p = this->data();
+      return parallel_reduce(
+          0, First, (Type)0,
+          [p](int lo, int hi) {
+            Type sumi = 0;
+            for (int i = lo; i < hi; i++) sumi += p[i];
+            return sumi;
+          },
+          [](Type a, Type b) { return a + b; }, PARALLEL_GRAIN);
     }
 
     constexpr size_t size() const { return First; }
     constexpr auto shape() const { return std::make_tuple(First); }
+    constexpr auto strides() const { return std::make_tuple(1); }
+
+    contiguous_view<Type, First> view() {
+      return contiguous_view<Type, First>(this->data());
+    }
+    contiguous_view<const Type, First> view() const {
+      return contiguous_view<const Type, First>(this->data());
+    }
     template <int... NArgs>
     ndarrayPtr<Type, NArgs...> reshape() const {
       static_assert(
@@ -129,21 +272,12 @@ namespace dpl {
           "usage : reshape<NArgs...> number of elements of reshaped array "
           "equal to called ndarray.");
       auto ret = make_ndarray_ptr<Type, NArgs...>();
-      for (int i = 0; i < size(); i++) ret->linerAt(i) = linerAt(i);
-      return std::move(ret);
+      std::copy(this->begin(), this->end(), ret->begin());
+      return ret;
     }
 
-    ndarray<Type, First>& operator<<(const Type& v) {
-      at(0) = v;
-      initialize_ps_ = 1;
-      return *this;
-    }
-
-    ndarray<Type, First>& operator,(const Type& v) {
-      if (initialize_ps_ >= size()) throw initialize_ndarray_error();
-      at(initialize_ps_) = v;
-      initialize_ps_++;
-      return *this;
+    ndarray_initializer<ndarray<Type, First>> operator<<(const Type& v) {
+      return ndarray_initializer<ndarray<Type, First>>(*this, v);
     }
 
     ndarray<Type, First>& each(std::function<void(Type&, int)> f,
@@ -161,20 +295,39 @@ namespace dpl {
       static_assert(0 < R && R <= First,
                     "ndarray<Type,First>.choice<R> : 0 < R < First dimention");
       each([](Type& v, int i) { v = (i < R ? 1 : 0); });
+      auto& mt = random_engine();
       int cnt = First;
       while (--cnt) {
-        auto ch_score =
-            std::make_shared<std::uniform_int_distribution<int>>(0, cnt);
-        int k = (*ch_score)(*mt);
+        std::uniform_int_distribution<int> ch_score(0, cnt);
+        int k = ch_score(mt);
         std::swap(at(k), at(cnt));
       }
       return *this;
     };
 
-   private:
-    size_t initialize_ps_;
-    std::shared_ptr<std::mt19937> mt;
-    std::shared_ptr<std::uniform_real_distribution<float>> score;
+    template <int R, typename U>
+    ndarrayPtr<Type, R> choice(const ndarray<U, First>& mask) const {
+      auto ret = make_ndarray_ptr<Type, R>();
+      for (int i = 0, j = 0; i < First && j < R; i++)
+        if (mask.at(i)) ret->at(j++) = at(i);
+      return ret;
+    };
+
+    // out[r] = at(index[r]) for r in [0, R)
+    template <int R>
+    void gather(const int* index, ndarray<Type, R>& out) const {
+      for (int r = 0; r < R; r++) out.at(r) = (*this)[index[r]];
+    }
+
+    // sliced [S, E) step is ST
+    template <int I, int S, int E, int ST>
+    ndarrayPtr<Type, (E - S) / ST> slice() const {
+      static_assert(I == 0 && ST > 0 && 0 <= S && S <= E && E <= First,
+                    "ndarray<Type,First>.slice : [S, E) out of range");
+      auto ret = make_ndarray_ptr<Type, (E - S) / ST>();
+      for (int i = 0; i < (E - S) / ST; i++) ret->at(i) = at(S + i * ST);
+      return ret;
+    }
   };
 
   template <typename Type, int First>
@@ -182,16 +335,49 @@ namespace dpl {
     os << "[ ";
     for (int i = 0; i < First; i++) {
       if (i) os << ", ";
-      os << a.at(i);
+      os << +a.at(i);  // uint8_t labels print as numbers
     }
     os << " ]";
     return os;
   }
 
+  // ndarray<Type, First, Second, Args...> keeps every element in one flat
+  // row-major std::array; at(i) hands out the i-th sub array as a view onto
+  // that buffer, so ndarray of any rank is laid out exactly like Type[size].
   template <typename Type, int First, int Second, int... Args>
   class ndarray<Type, First, Second, Args...>
-      : public std::array<ndarray<Type, Second, Args...>, First> {
+      : public std::array<Type, GetFact<sizeof...(Args) + 1, First, Second,
+                                        Args...>::value> {
    private:
+    using base_ = std::array<
+        Type, GetFact<sizeof...(Args) + 1, First, Second, Args...>::value>;
+    using sub_array_ = ndarray<Type, Second, Args...>;
+    static constexpr int SUB_SIZE =
+        GetFact<sizeof...(Args), Second, Args...>::value;
+
+    // offset_<D>(i_D, i_D+1, ...) = i_D * stride_D + i_D+1 * stride_D+1 + ...
+    template <int D>
+    static int offset_() {
+      return 0;
+    }
+    template <int D, typename... Int>
+    static int offset_(int i, Int... args) {
+      if (i < 0 || i >= Get<D, First, Second, Args...>::value)
+        throw std::out_of_range("ndarray::at");
+      return i * GetStride<D, First, Second, Args...>::value +
+             offset_<D + 1>(args...);
+    }
+
+    sub_array_& sub_(int i) {
+      if (i < 0 || i >= First) throw std::out_of_range("ndarray::at");
+      return *reinterpret_cast<sub_array_*>(base_::data() + i * SUB_SIZE);
+    }
+    const sub_array_& sub_(int i) const {
+      if (i < 0 || i >= First) throw std::out_of_range("ndarray::at");
+      return *reinterpret_cast<const sub_array_*>(base_::data() +
+                                                  i * SUB_SIZE);
+    }
+
     //================================================================
     // DimExpand<D, Dims...>
     // D : sizeof Dimentions
@@ -326,9 +512,19 @@ namespace dpl {
     //================================================================
 
    public:
-    ndarray() : initialize_ps_(0) {
-      std::random_device rd;
-      mt = std::make_shared<std::mt19937>(rd());
+    using base_::size;
+
+    ndarray() {}
+
+    // evaluate an elementwise expression in one pass, without temporaries
+    template <class Op, class L, class R>
+    ndarray<Type, First, Second, Args...>& operator=(
+        const ndexpr<ndarray<Type, First, Second, Args...>, Op, L, R>& e) {
+      Type* p = this->data();
+      parallel_for(0, size(), [p, &e](int lo, int hi) {
+        for (int i = lo; i < hi; i++) p[i] = e[i];
+      }, PARALLEL_GRAIN);
+      return *this;
     }
 
     ndarray<Type, First, Second, Args...>& at() { return *this; }
@@ -336,35 +532,47 @@ namespace dpl {
 
     template <typename... Int>
     auto& at(int i, Int... args) {
-      return std::array<ndarray<Type, Second, Args...>, First>::at(i).at(
-          args...);
+      if constexpr (sizeof...(Int) == sizeof...(Args) + 1)
+        return base_::operator[](offset_<0>(i, args...));
+      else
+        return sub_(i).at(args...);
     }
     template <typename... Int>
     const auto& at(int i, Int... args) const {
-      return std::array<ndarray<Type, Second, Args...>, First>::at(i).at(
-          args...);
+      if constexpr (sizeof...(Int) == sizeof...(Args) + 1)
+        return base_::operator[](offset_<0>(i, args...));
+      else
+        return sub_(i).at(args...);
     }
 
-    Type& linerAt(int index) {
-      return at(index / at(0).size()).linerAt(index % at(0).size());
-    }
-    const Type& linerAt(int index) const {
-      return at(index / at(0).size()).linerAt(index % at(0).size());
-    }
+    Type& linerAt(int index) { return base_::at(index); }
+    const Type& linerAt(int index) const { return base_::at(index); }
 
     ndarray<Type, First, Second, Args...>& fill(const Type& v) {
-      for (int i = 0; i < First; i++) at(i).fill(v);
+      base_::fill(v);
       return *this;
     }
     ndarray<Type, First, Second, Args...>& rand() {
-      for (int i = 0; i < First; i++) at(i).rand();
+      return rand(random_engine());
+    };
+    ndarray<Type, First, Second, Args...>& rand(philox_engine& engine) {
+      random_uniform(this->data(), this->size(), engine);
       return *this;
     };
 
-    constexpr size_t size() const { return First * at(0).size(); }
     constexpr auto shape() const {
       return std::make_tuple(First, Second, Args...);
     }
+    constexpr auto strides() const {
+      return strides_(std::make_integer_sequence<int, sizeof...(Args) + 2>());
+    }
+
+    contiguous_view<Type, First, Second, Args...> view() {
+      return contiguous_view<Type, First, Second, Args...>(this->data());
+    }
+    contiguous_view<const Type, First, Second, Args...> view() const {
+      return contiguous_view<const Type, First, Second, Args...>(this->data());
+    }
     template <int... NArgs>
     ndarrayPtr<Type, NArgs...> reshape() const {
       static_assert(
@@ -373,24 +581,15 @@ namespace dpl {
           "usage : reshape<NArgs...> number of elements of reshaped array "
           "equal to called ndarray.");
       auto ret = make_ndarray_ptr<Type, NArgs...>();
-      for (int i = 0; i < size(); i++) ret->linerAt(i) = linerAt(i);
-      return std::move(ret);
+      std::copy(this->begin(), this->end(), ret->begin());
+      return ret;
     }
 
    private:
-    template <int... NArgs>
-    void make_transpose_(Type& v, int id) const {
-      static_assert(sizeof...(NArgs) == 0);
-      v = linerAt(id);
-    }
-
-    template <int F, int... NArgs>
-    void make_transpose_(
-        typename GetTransposedArray<F, NArgs...>::type& transpose_array,
-        int id) const {
-      for (int i = 0; i < Get<F, First, Second, Args...>::value;
-           i++, id += size() / GetFact<F, First, Second, Args...>::value)
-        make_transpose_<NArgs...>(transpose_array.at(i), id);
+    template <int... Is>
+    constexpr auto strides_(std::integer_sequence<int, Is...>) const {
+      return std::make_tuple(
+          (int)GetStride<Is, First, Second, Args...>::value...);
     }
 
    public:
@@ -403,24 +602,35 @@ namespace dpl {
       static_assert(sizeof...(NArgs) == sizeof...(Args) + 2,
                     "Transpose don't match number of arguments.");
       auto ret =
-          std::make_shared<typename GetTransposedArray<NArgs...>::type>();
-      make_transpose_<NArgs...>(*ret, 0);
-      return std::move(ret);
+          make_ndarray_ptr_<typename GetTransposedArray<NArgs...>::type>();
+      using dims = std::integer_sequence<
+          int, Get<NArgs, First, Second, Args...>::value...>;
+      using strides = std::integer_sequence<
+          int, GetStride<NArgs, First, Second, Args...>::value...>;
+      StridedCopy<dims, strides>::apply(this->data(), ret->data());
+      return ret;
     }
 
    private:
-    template <int I>
-    void make_reverse_transpose_(Type& v, int id) const {
-      v = linerAt(id);
+    // make_ndarray_ptr for an ndarray type computed by the Get*Array helpers
+    template <class Array>
+    struct MakeArrayPtr;
+
+    template <typename U, int... Dims>
+    struct MakeArrayPtr<ndarray<U, Dims...>> {
+      static ndarrayPtr<U, Dims...> make() {
+        return make_ndarray_ptr<U, Dims...>();
+      }
+    };
+
+    template <class Array>
+    static std::shared_ptr<Array> make_ndarray_ptr_() {
+      return MakeArrayPtr<Array>::make();
     }
 
-    template <int I>
-    void make_reverse_transpose_(
-        typename GetReversedTransposedArray<I>::type& transposed_array,
-        int id) const {
-      for (int i = 0; i < Get<I - 1, First, Second, Args...>::value;
-           i++, id += size() / GetFact<I - 1, First, Second, Args...>::value)
-        make_reverse_transpose_<I - 1>(transposed_array.at(i), id);
+    template <int... Is>
+    auto reverse_transpose_(std::integer_sequence<int, Is...>) const {
+      return transpose<sizeof...(Args) + 1 - Is...>();
     }
 
    public:
@@ -428,12 +638,42 @@ namespace dpl {
     std::shared_ptr<
         typename GetReversedTransposedArray<sizeof...(Args) + 2>::type>
     T() const {
-      auto ret = std::make_shared<
-          typename GetReversedTransposedArray<sizeof...(Args) + 2>::type>();
-      make_reverse_transpose_<sizeof...(Args) + 2>(*ret, 0);
-      return std::move(ret);
+      return reverse_transpose_(
+          std::make_integer_sequence<int, sizeof...(Args) + 2>());
+    }
+
+   private:
+    //================================================================
+    // AxisShape_<I> : the array seen as [OUTER][AXIS][INNER] around axis I
+    template <int I>
+    struct AxisShape_ {
+      enum {
+        AXIS = Get<I, First, Second, Args...>::value,
+        OUTER = GetFact<I, First, Second, Args...>::value / AXIS,
+        INNER = GetFact<sizeof...(Args) + 1, First, Second, Args...>::value /
+                GetFact<I, First, Second, Args...>::value
+      };
+    };
+    //================================================================
+
+    /**
+     * f(src, dst, lo, hi) for every outer index, with src pointing at
+     * [AXIS][INNER] and dst at [INNER]; [lo, hi) is the inner range to
+     * reduce. Runs in parallel over OUTER * INNER.
+     */
+    template <int I, typename U, class F>
+    void reduce_axis_(U* dst, F f) const {
+      using shape = AxisShape_<I>;
+      constexpr int AXIS = shape::AXIS, INNER = shape::INNER;
+      const Type* src = this->data();
+      parallel_for(0, shape::OUTER * INNER, [&](int lo, int hi) {
+        for (int o = lo / INNER; o * INNER < hi; o++)
+          f(src + o * AXIS * INNER, dst + o * INNER,
+            std::max(lo - o * INNER, 0), std::min(hi - o * INNER, INNER));
+      }, std::max(1, PARALLEL_GRAIN / AXIS));
     }
 
+   public:
     // argmax, axis = I
     template <int I>
     std::shared_ptr<
@@ -441,21 +681,28 @@ namespace dpl {
     argmax() const {
       auto ret = std::make_shared<typename GetDecreaseDimArray<
           unsigned, I, First, Second, Args...>::type>();
-      const int jk = size() / GetFact<I, First, Second, Args...>::value;
-      const int f = Get<I, First, Second, Args...>::value;
-      auto fl = std::make_shared<std::bitset<
-          GetFact<sizeof...(Args) + 1, First, Second, Args...>::value>>();
-      (*fl) = 0;
-      for (int i = 0, id = 0; i < ret->size(); i++) {
-        ret->linerAt(i) = 0;
-        while ((*fl)[id]) id++;
-        for (int j = 0, jd = id; j < f; j++, jd += jk) {
-          (*fl)[jd] = true;
-          if (linerAt(id + ret->linerAt(i) * jk) < linerAt(jd))
-            ret->linerAt(i) = j;
+      constexpr int AXIS = AxisShape_<I>::AXIS, INNER = AxisShape_<I>::INNER;
+      reduce_axis_<I>(ret->data(), [](const Type* src, unsigned* dst, int lo,
+                                      int hi) {
+        constexpr int BLOCK = 64;
+        Type best[BLOCK];
+        for (int b = lo; b < hi; b += BLOCK) {
+          const int n = std::min(BLOCK, hi - b);
+          for (int i = 0; i < n; i++) {
+            best[i] = src[b + i];
+            dst[b + i] = 0;
+          }
+          for (int j = 1; j < AXIS; j++) {
+            const Type* row = src + j * INNER + b;
+            for (int i = 0; i < n; i++)
+              if (best[i] < row[i]) {
+                best[i] = row[i];
+                dst[b + i] = j;
+              }
+          }
         }
-      }
-      return std::move(ret);
+      });
+      return ret;
     }
 
     // max, axis = I
@@ -466,28 +713,28 @@ namespace dpl {
       auto ret =
           std::make_shared<typename GetDecreaseDimArray<Type, I, First, Second,
                                                         Args...>::type>();
-      const int jk = size() / GetFact<I, First, Second, Args...>::value;
-      const int f = Get<I, First, Second, Args...>::value;
-      auto fl = std::make_shared<std::bitset<
-          GetFact<sizeof...(Args) + 1, First, Second, Args...>::value>>();
-      (*fl) = 0;
-      for (int i = 0, id = 0; i < ret->size(); i++) {
-        while ((*fl)[id]) id++;
-        ret->linerAt(i) = linerAt(id);
-        for (int j = 0, jd = id; j < f; j++, jd += jk) {
-          (*fl)[jd] = true;
-          ret->linerAt(i) = std::max(ret->linerAt(i), linerAt(jd));
+      constexpr int AXIS = AxisShape_<I>::AXIS, INNER = AxisShape_<I>::INNER;
+      reduce_axis_<I>(ret->data(), [](const Type* src, Type* dst, int lo,
+                                      int hi) {
+        for (int i = lo; i < hi; i++) dst[i] = src[i];
+        for (int j = 1; j < AXIS; j++) {
+          const Type* row = src + j * INNER;
+          for (int i = lo; i < hi; i++) dst[i] = std::max(dst[i], row[i]);
         }
-      }
-      return std::move(ret);
+      });
+      return ret;
     }
 
     Type max() const {
-      Type maxi = std::numeric_limits<Type>::min();
-      for (int i = 0; i < size(); i++) {
-        maxi = std::max(maxi, linerAt(i));
-      }
-      return maxi;
+      const Type* p = this->data();
+      return parallel_reduce(
+          0, size(), std::numeric_limits<Type>::lowest(),
+          [p](int lo, int hi) {
+            Type maxi = std::numeric_limits<Type>::lowest();
+            for (int i = lo; i < hi; i++) maxi = std::max(maxi, p[i]);
+            return maxi;
+          },
+          [](Type a, Type b) { return std::max(a, b); }, PARALLEL_GRAIN);
     }
 
     // sum, axis = I
@@ -496,41 +743,45 @@ namespace dpl {
       auto ret =
           std::make_shared<typename GetDecreaseDimArray<Type, I, First, Second,
                                                         Args...>::type>();
-      const int jk = size() / GetFact<I, First, Second, Args...>::value;
-      const int f = Get<I, First, Second, Args...>::value;
-      auto fl = std::make_shared<std::bitset<
-          GetFact<sizeof...(Args) + 1, First, Second, Args...>::value>>();
-      (*fl) = 0;
-      for (int i = 0, id = 0; i < ret->size(); i++) {
-        while ((*fl)[id]) id++;
-        ret->linerAt(i) = 0;
-        for (int j = 0, jd = id; j < f; j++, jd += jk) {
-          (*fl)[jd] = true;
-          ret->linerAt(i) += linerAt(jd);
+      constexpr int AXIS = AxisShape_<I>::AXIS, INNER = AxisShape_<I>::INNER;
+      reduce_axis_<I>(ret->data(), [](const Type* src, Type* dst, int lo,
+                                      int hi) {
+        for (int i = lo; i < hi; i++) dst[i] = 0;
+        for (int j = 0; j < AXIS; j++) {
+          const Type* row = src + j * INNER;
+          for (int i = lo; i < hi; i++) dst[i] += row[i];
         }
-      }
-      return std::move(ret);
+      });
+      return ret;
     }
 
     // sliced i-th[S, E) step is ST
     template <int I, int S, int E, int ST>
     auto slice() const {
       static_assert(ST > 0, "ST must be ST > 0");
-      auto ret =
-          std::make_shared<typename GetSlicedArray<I, (E - S) / ST, First,
-                                                   Second, Args...>::type>();
-      const int jk = size() / GetFact<I, First, Second, Args...>::value;
-      const int f = Get<I, First, Second, Args...>::value;
-      for (int i = 0, id = jk * S; i < size() / jk / f; i++, id += f * jk) {
-        for (int j = 0; j < (E - S); j += ST) {
-          for (int k = 0; k < jk; k++)
-            ret->linerAt(i * jk * ((E - S) / ST) + j / ST * jk + k) =
-                linerAt(id + j * jk + k);
-        }
-      }
-      return std::move(ret);
+      auto ret = make_ndarray_ptr_<typename GetSlicedArray<
+          I, (E - S) / ST, First, Second, Args...>::type>();
+      slice_<I, S, E, ST>(
+          ret->data(), std::make_integer_sequence<int, sizeof...(Args) + 2>());
+      return ret;
     }
 
+   private:
+    template <int I, int S, int E, int ST, int... Is>
+    void slice_(Type* dst, std::integer_sequence<int, Is...>) const {
+      StridedCopy<
+          std::integer_sequence<int, (Is == I ? (E - S) / ST
+                                              : Get<Is, First, Second,
+                                                    Args...>::value)...>,
+          std::integer_sequence<
+              int, GetStride<Is, First, Second, Args...>::value *
+                       (Is == I ? ST : 1)...>>::
+          apply(this->data() + S * GetStride<I, First, Second, Args...>::value,
+                dst);
+    }
+
+   public:
+
     /*
      * Parameters
      * ----------
@@ -557,69 +808,112 @@ namespace dpl {
                     "usage : can only used by ndarray<Type, number of data, "
                     "number of cahnel, "
                     "height, weight>.im2col type");
-      constexpr int N = First;
-      constexpr int C = Second;
       constexpr int H = Get<0, Args...>::value;
       constexpr int W = Get<1, Args...>::value;
       constexpr int OUT_H = (H + 2 * PAD - FILTER_H) / STRIDE + 1;
       constexpr int OUT_W = (W + 2 * PAD - FILTER_W) / STRIDE + 1;
 
-      auto img = make_ndarray_ptr<Type, N, C, H + PAD * 2, W + PAD * 2>();
-      img->fill(0);
-      for (int n = 0; n < N; n++)
-        for (int c = 0; c < C; c++)
-          for (int y = 0; y < H; y++)
-            for (int x = 0; x < W; x++)
-              img->at(n, c, y + PAD, x + PAD) = at(n, c, y, x);
-
-      auto col =
-          make_ndarray_ptr<Type, N, OUT_H, OUT_W, C, FILTER_H, FILTER_W>();
-      col->fill(0);
-      for (int n = 0; n < N; n++)
-        for (int c = 0; c < C; c++)
-          for (int y = 0; y < FILTER_H; y++)
-            for (int x = 0; x < FILTER_W; x++)
-              for (int oy = 0, iy = y; iy < y + STRIDE * OUT_H;
-                   oy++, iy += STRIDE)
-                for (int ox = 0, ix = x; ix < x + STRIDE * OUT_W;
-                     ox++, ix += STRIDE)
-                  col->at(n, oy, ox, c, y, x) = img->at(n, c, iy, ix);
+      auto col = make_ndarray_ptr<Type, First * OUT_H * OUT_W,
+                                  Second * FILTER_H * FILTER_W>();
+      im2col<FILTER_H, FILTER_W, STRIDE, PAD>(*col);
+      return col;
+    }
 
-      auto ret =
-          make_ndarray_ptr<Type, N * OUT_H * OUT_W, C * FILTER_H * FILTER_W>();
-      for (int i = 0; i < ret->size(); i++) ret->linerAt(i) = col->linerAt(i);
-      return std::move(ret);
+    // im2col into a caller provided
+    // ndarray<Type, N * OUT_H * OUT_W, C * FILTER_H * FILTER_W>.
+    // Every patch is written once, padding is produced on the fly.
+    template <int FILTER_H, int FILTER_W, int STRIDE, int PAD, class Col>
+    Col& im2col(Col& col) const {
+      static_assert(sizeof...(Args) == 2,
+                    "usage : can only used by ndarray<Type, number of data, "
+                    "number of cahnel, "
+                    "height, weight>.im2col type");
+      constexpr int N = First;
+      constexpr int C = Second;
+      constexpr int H = Get<0, Args...>::value;
+      constexpr int W = Get<1, Args...>::value;
+      constexpr int OUT_H = (H + 2 * PAD - FILTER_H) / STRIDE + 1;
+      constexpr int OUT_W = (W + 2 * PAD - FILTER_W) / STRIDE + 1;
+      static_assert(
+          std::is_same<Col, ndarray<Type, N * OUT_H * OUT_W,
+                                    C * FILTER_H * FILTER_W>>::value,
+          "usage : im2col(col) col must be ndarray<Type, N * OUT_H * OUT_W, "
+          "C * FILTER_H * FILTER_W>");
+
+      const Type* img = this->data();
+      Type* out = col.data();
+      // one task per output row (n, oy)
+      parallel_for(0, N * OUT_H, [img, out](int lo, int hi) {
+        Type* dst = out + lo * OUT_W * C * FILTER_H * FILTER_W;
+        for (int r = lo; r < hi; r++) {
+          const int n = r / OUT_H, oy = r % OUT_H;
+          for (int ox = 0; ox < OUT_W; ox++)
+            for (int c = 0; c < C; c++) {
+              const Type* src = img + (n * C + c) * H * W;
+              for (int fy = 0; fy < FILTER_H; fy++, dst += FILTER_W) {
+                const int iy = oy * STRIDE + fy - PAD;
+                if (iy < 0 || iy >= H) {
+                  std::fill(dst, dst + FILTER_W, 0);
+                  continue;
+                }
+                for (int fx = 0; fx < FILTER_W; fx++) {
+                  const int ix = ox * STRIDE + fx - PAD;
+                  dst[fx] = (0 <= ix && ix < W) ? src[iy * W + ix] : 0;
+                }
+              }
+            }
+        }
+      });
+      return col;
     }
 
+    // inverse of im2col : every patch is added back onto the image it was
+    // taken from, so overlapping patches accumulate
     template <int N, int C, int H, int W, int FILTER_H, int FILTER_W,
               int STRIDE, int PAD>
     auto col2im() const {
-      static_assert(
-          sizeof...(Args) == 0,
-          "usage : can only used by ndarray<Type, number of data * "
-          "out_h * out_w, c * filter_h * filter_w * stride * pad>.col2im ");
+      auto img = make_ndarray_ptr<Type, N, C, H, W>();
+      col2im<N, C, H, W, FILTER_H, FILTER_W, STRIDE, PAD>(*img);
+      return img;
+    };
+
+    // col2im into a caller provided ndarray<Type, N, C, H, W>, one pass
+    // per (n, c) image plane, planes in parallel
+    template <int N, int C, int H, int W, int FILTER_H, int FILTER_W,
+              int STRIDE, int PAD>
+    ndarray<Type, N, C, H, W>& col2im(ndarray<Type, N, C, H, W>& img) const {
       constexpr int OUT_H = (H + 2 * PAD - FILTER_H) / STRIDE + 1;
       constexpr int OUT_W = (W + 2 * PAD - FILTER_W) / STRIDE + 1;
-
-      auto col =
-          make_ndarray_ptr<Type, N, OUT_H, OUT_W, C, FILTER_H, FILTER_W>();
-      for (int i = 0; i < col->size(); i++) col->linerAt(i) = linerAt(i);
-
-      auto img = make_ndarray_ptr<Type, N, C, H + PAD * 2, W + PAD * 2>();
-      img->fill(0);
-      for (int n = 0; n < N; n++)
-        for (int c = 0; c < C; c++)
-          for (int y = 0; y < FILTER_H; y++)
-            for (int x = 0; x < FILTER_W; x++)
-              for (int oy = 0, iy = y; iy < y + STRIDE * OUT_H;
-                   oy++, iy += STRIDE)
-                for (int ox = 0, ix = x; ix < x + STRIDE * OUT_W;
-                     ox++, ix += STRIDE)
-                  img->at(n, c, iy, ix) = col->at(n, oy, ox, c, y, x);
-      auto ret = img->template slice<2, PAD, PAD + H, 1>()
-                     ->template slice<3, PAD, PAD + H, 1>();
-      return std::move(ret);
-    };
+      static_assert(
+          sizeof...(Args) == 0 && First == N * OUT_H * OUT_W &&
+              Second == C * FILTER_H * FILTER_W,
+          "usage : can only used by ndarray<Type, number of data * "
+          "out_h * out_w, c * filter_h * filter_w>.col2im ");
+      constexpr int PATCH = FILTER_H * FILTER_W;
+
+      const Type* col = this->data();
+      Type* out = img.data();
+      parallel_for(0, N * C, [col, out](int lo, int hi) {
+        for (int plane = lo; plane < hi; plane++) {
+          const int n = plane / C, c = plane % C;
+          Type* dst = out + plane * H * W;
+          std::fill(dst, dst + H * W, 0);
+          const Type* src = col + n * OUT_H * OUT_W * C * PATCH + c * PATCH;
+          for (int oy = 0; oy < OUT_H; oy++)
+            for (int ox = 0; ox < OUT_W; ox++, src += C * PATCH)
+              for (int fy = 0; fy < FILTER_H; fy++) {
+                const int iy = oy * STRIDE + fy - PAD;
+                if (iy < 0 || iy >= H) continue;
+                for (int fx = 0; fx < FILTER_W; fx++) {
+                  const int ix = ox * STRIDE + fx - PAD;
+                  if (0 <= ix && ix < W)
+                    dst[iy * W + ix] += src[fy * FILTER_W + fx];
+                }
+              }
+        }
+      });
+      return img;
+    }
 
     template <int I, int PAD_L, int PAD_R>
     auto pad() const {
@@ -630,24 +924,19 @@ namespace dpl {
       const int jk = size() / GetFact<I, First, Second, Args...>::value;
       const int f = Get<I, First, Second, Args...>::value;
 
-      for (int i = 0, id = jk * PAD_L; i < size() / jk / f;
-           i++, id += jk * (f + PAD_L + PAD_R))
-        for (int j = 0, jd = id; j < jk * f; j++, jd++)
-          ret->linerAt(jd) = linerAt(i * jk * f + j);
+      const Type* src = this->data();
+      Type* dst = ret->data() + jk * PAD_L;
+      for (int i = 0; i < (int)size() / jk / f;
+           i++, src += jk * f, dst += jk * (f + PAD_L + PAD_R))
+        std::copy(src, src + jk * f, dst);
 
-      return std::move(ret);
+      return ret;
     }
 
-    ndarray<Type, First, Second, Args...>& operator<<(const Type& v) {
-      at(0) << v;
-      initialize_ps_ = 1;
-      return *this;
-    }
-    ndarray<Type, First, Second, Args...>& operator,(const Type& v) {
-      if (initialize_ps_ >= size()) throw initialize_ndarray_error();
-      at(initialize_ps_ / at(0).size()), v;
-      initialize_ps_++;
-      return *this;
+    ndarray_initializer<ndarray<Type, First, Second, Args...>> operator<<(
+        const Type& v) {
+      return ndarray_initializer<ndarray<Type, First, Second, Args...>>(*this,
+                                                                        v);
     }
 
     template <int Index>
@@ -657,11 +946,11 @@ namespace dpl {
 
     ndarray<Type, First, Second, Args...>& each(
         std::function<void(Type&, int)> f, int index = 0) {
-      for (int i = 0; i < size(); i++) f(linerAt(i), i);
+      for (int i = 0; i < (int)size(); i++) f((*this)[i], i);
       return *this;
     }
     ndarray<Type, First, Second, Args...>& each(std::function<void(Type&)> f) {
-      for (int i = 0; i < First; i++) at(i).each(f);
+      for (auto& v : *this) f(v);
       return *this;
     }
 
@@ -684,87 +973,29 @@ namespace dpl {
       return std::move(ret);
     };
 
-   private:
-    size_t initialize_ps_;
-    std::shared_ptr<std::mt19937> mt;
-    std::shared_ptr<std::uniform_int_distribution<int>> ch_score;
-  };  // namespace dpl
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator+(const ndarray<Type, Ints...>& a,
-                                      const ndarray<Type, Ints...>& b) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++)
-      ret->linerAt(i) = a.linerAt(i) + b.linerAt(i);
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator+(const ndarray<Type, Ints...>& a,
-                                      const Type& v) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++) ret->linerAt(i) = a.linerAt(i) + v;
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator*(const ndarray<Type, Ints...>& a,
-                                      const ndarray<Type, Ints...>& b) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++)
-      ret->linerAt(i) = a.linerAt(i) * b.linerAt(i);
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator*(const ndarray<Type, Ints...>& a,
-                                      const Type& v) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++) ret->linerAt(i) = a.linerAt(i) * v;
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator-(const ndarray<Type, Ints...>& a,
-                                      const ndarray<Type, Ints...>& b) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++)
-      ret->linerAt(i) = a.linerAt(i) - b.linerAt(i);
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator-(const ndarray<Type, Ints...>& a,
-                                      const Type& v) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++) ret->linerAt(i) = a.linerAt(i) - v;
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator/(const ndarray<Type, Ints...>& a,
-                                      const ndarray<Type, Ints...>& b) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++)
-      ret->linerAt(i) = a.linerAt(i) / b.linerAt(i);
-    return std::move(ret);
-  }
-
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> operator/(const ndarray<Type, Ints...>& a,
-                                      const Type& v) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < ret->size(); i++) ret->linerAt(i) = a.linerAt(i) / v;
-    return std::move(ret);
-  }
+    /**
+     * out[r] = at(index[r]) for r in [0, R), whole rows copied in parallel.
+     * O(R) work, against O(First) for choice.
+     */
+    template <int R>
+    void gather(const int* index,
+                ndarray<Type, R, Second, Args...>& out) const {
+      constexpr int ROW = GetFact<sizeof...(Args), Second, Args...>::value;
+      const Type* src = this->data();
+      Type* dst = out.data();
+      parallel_for(0, R, [=](int lo, int hi) {
+        for (int r = lo; r < hi; r++)
+          std::copy(src + (std::size_t)index[r] * ROW,
+                    src + (std::size_t)index[r] * ROW + ROW, dst + r * ROW);
+      }, PARALLEL_GRAIN / ROW);
+    }
+  };
 
   template <typename Type, int... Ints>
   bool nearly(const ndarray<Type, Ints...>& a, const ndarray<Type, Ints...>& b,
               const Type& eps) {
     for (int i = 0; i < a.size(); i++)
-      if (!(a.linerAt(i) - eps < b.linerAt(i) &&
-            b.linerAt(i) < a.linerAt(i) + eps))
-        return false;
+      if (!(a[i] - eps < b[i] && b[i] < a[i] + eps)) return false;
     return true;
   };
 
@@ -784,54 +1015,54 @@ namespace dpl {
   ndarrayPtr<Type, First, Third> dot(const ndarray<Type, First, Second>& a,
                                      const ndarray<Type, Second, Third>& b) {
     auto ret = make_ndarray_ptr<Type, First, Third>();
-    ret->fill(0);
-    for (int i = 0; i < First; i++)
-      for (int j = 0; j < Second; j++)
-        for (int k = 0; k < Third; k++)
-          ret->at(i, k) += a.at(i, j) * b.at(j, k);
-    return std::move(ret);
+    gemm(First, Third, Second, a.data(), Second, 1, b.data(), Third, 1,
+         ret->data(), Third);
+    return ret;
   }
 
-  template <typename Type, int... Ints>
-  ndarrayPtr<Type, Ints...> maximum(const ndarray<Type, Ints...>& a,
-                                    const ndarray<Type, Ints...>& b) {
-    auto ret = make_ndarray_ptr<Type, Ints...>();
-    for (int i = 0; i < a.size(); i++)
-      ret->linerAt(i) = std::max(a.linerAt(i), b.linerAt(i));
-    return std::move(ret);
+  // dot(a, b.T()) without materializing b.T()
+  template <typename Type, int First, int Second, int Third>
+  ndarrayPtr<Type, First, Third> dot_nt(const ndarray<Type, First, Second>& a,
+                                        const ndarray<Type, Third, Second>& b) {
+    auto ret = make_ndarray_ptr<Type, First, Third>();
+    gemm(First, Third, Second, a.data(), Second, 1, b.data(), 1, Second,
+         ret->data(), Third);
+    return ret;
   }
 
-  template <typename Type, int... Dims>
-  ndarrayPtr<Type, Dims...> exp(const ndarray<Type, Dims...>& input) {
-    auto ret = make_ndarray_ptr<Type, Dims...>();
-    for (int i = 0; i < ret->size(); i++)
-      ret->linerAt(i) = std::exp(input.linerAt(i));
-    return std::move(ret);
-  };
+  // dot(a.T(), b) without materializing a.T()
+  template <typename Type, int First, int Second, int Third>
+  ndarrayPtr<Type, First, Third> dot_tn(const ndarray<Type, Second, First>& a,
+                                        const ndarray<Type, Second, Third>& b) {
+    auto ret = make_ndarray_ptr<Type, First, Third>();
+    gemm(First, Third, Second, a.data(), 1, First, b.data(), Third, 1,
+         ret->data(), Third);
+    return ret;
+  }
 
   template <typename Type, int... Ints>
   ndarrayPtr<Type, Ints...> softmax(const ndarray<Type, Ints...>& x) {
-    auto exp_x = exp(*(x - x.max()));
-    return std::move(*exp_x / exp_x->sum());
+    auto ret = make_ndarray_ptr<Type, Ints...>();
+    *ret = x;
+    *ret -= x.max();
+    *ret = exp(ret);
+    *ret /= ret->sum();
+    return ret;
   }
 
+  // row-wise softmax
   template <typename Type, int First, int Second>
   ndarrayPtr<Type, First, Second> softmax(
       const ndarray<Type, First, Second>& x) {
-    ndarrayPtr<Type, Second, First> xt = x.T();
-    ndarrayPtr<Type, First> xm = xt->template max<0>();
-    auto xx = make_ndarray_ptr<Type, First, Second>();
-    for (int i = 0; i < First; i++) {
-      xx->at(i) = *(x.at(i) - xm->at(i));
-    }
-    ndarrayPtr<Type, First, Second> exp_x = exp(*xx);
-
-    ndarrayPtr<Type, First> sum_exp_x = exp_x->template sum<1>();
     auto ret = make_ndarray_ptr<Type, First, Second>();
     for (int i = 0; i < First; i++) {
-      ret->at(i) = *(exp_x->at(i) / sum_exp_x->at(i));
+      auto& row = ret->at(i);
+      const auto& in = x.at(i);
+      const Type m = in.max();
+      for (int j = 0; j < Second; j++) row[j] = std::exp(in[j] - m);
+      row /= row.sum();
     }
-    return std::move(ret);
+    return ret;
   }
 
   template <typename Type, int N, int M>
@@ -845,6 +1076,52 @@ namespace dpl {
     return -sum / N;
   };
 
+  /**
+   * fused row-wise log-softmax + negative log likelihood
+   * label[i] : class of row i
+   * dx = (softmax(x) - onehot(label)) / N, written without temporaries
+   * @return mean of -log softmax(x)[i, label[i]]
+   *
+   * Every row takes one sweep for its maximum, one computing exp(x - max)
+   * into dx and their sum, and one normalizing dx; the loss is
+   * log(sum) + max - x[label], so no exp is ever divided then logged.
+   */
+  template <typename Type, int N, int M, typename Label>
+  Type softmax_cross_entropy(const ndarray<Type, N, M>& x,
+                             const ndarray<Label, N>& label,
+                             ndarray<Type, N, M>& dx) {
+    // labels index the rows : reject bad ones before any thread reads
+    for (int i = 0; i < N; i++)
+      if ((long)label[i] < 0 || (long)label[i] >= M)
+        throw std::out_of_range("softmax_cross_entropy : label");
+    const Type* px = x.data();
+    Type* pdx = dx.data();
+    const Type loss = parallel_reduce(
+        0, N, (Type)0,
+        [&](int lo, int hi) {
+          Type sum = 0;
+          for (int i = lo; i < hi; i++) {
+            const Type* row = px + i * M;
+            Type* g = pdx + i * M;
+            Type m = row[0];
+            for (int j = 1; j < M; j++) m = std::max(m, row[j]);
+            Type z = 0;
+            for (int j = 0; j < M; j++) z += g[j] = std::exp(row[j] - m);
+            const int t = label[i];
+            sum += std::log(z) + m - row[t];
+            const Type scale = (Type)1 / (z * N);
+            for (int j = 0; j < M; j++) g[j] *= scale;
+            g[t] -= (Type)1 / N;
+          }
+          return sum;
+        },
+        [](Type a, Type b) { return a + b; }, std::max(1, PARALLEL_GRAIN / M));
+    return loss / N;
+  }
+
 }  // namespace dpl
 
+#include "expression.hpp"
+#include "ndarray_view.hpp"
+
 #endif  // DEEP_LEARNING_FROM_SCRATCH_NDARRAY_HPP
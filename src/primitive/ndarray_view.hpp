@@ -0,0 +1,228 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_NDARRAY_VIEW_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_NDARRAY_VIEW_HPP
+
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "ndarray.hpp"
+
+namespace dpl {
+
+  /**
+   * ndarray_view
+   *
+   * Non-owning window onto the element buffer of an ndarray. Shape and
+   * strides are part of the type, so reshape (of a contiguous view), slice
+   * and transpose only build a new view over the same buffer. Call copy()
+   * when a kernel needs a contiguous ndarray.
+   *
+   * The viewed ndarray must outlive the view.
+   *
+   * @tparam Type element type (const Type for a read only view)
+   * @tparam Shape std::integer_sequence<int, Dims...>
+   * @tparam Strides std::integer_sequence<int, Strides...>
+   */
+  template <typename Type, class Shape, class Strides>
+  class ndarray_view;
+
+  template <typename Type, int... Dims, int... Strides>
+  class ndarray_view<Type, std::integer_sequence<int, Dims...>,
+                     std::integer_sequence<int, Strides...>> {
+    static_assert(sizeof...(Dims) == sizeof...(Strides),
+                  "ndarray_view : shape and strides must have same rank");
+
+   private:
+    using value_type_ = std::remove_const_t<Type>;
+    static constexpr int RANK = sizeof...(Dims);
+
+    template <class Seq, int I>
+    struct Drop;
+
+    template <int F, int... Ints, int I>
+    struct Drop<std::integer_sequence<int, F, Ints...>, I> {
+      using type = typename Drop<std::integer_sequence<int, Ints...>,
+                                 I - 1>::type;
+    };
+
+    template <int F, int... Ints>
+    struct Drop<std::integer_sequence<int, F, Ints...>, 0> {
+      using type = std::integer_sequence<int, F, Ints...>;
+    };
+
+    template <int I>
+    struct Drop<std::integer_sequence<int>, I> {
+      using type = std::integer_sequence<int>;
+    };
+
+    template <int D>
+    static int offset_() {
+      return 0;
+    }
+    template <int D, typename... Int>
+    static int offset_(int i, Int... args) {
+      if (i < 0 || i >= Get<D, Dims...>::value)
+        throw std::out_of_range("ndarray_view::at");
+      return i * Get<D, Strides...>::value + offset_<D + 1>(args...);
+    }
+
+    template <int D>
+    static int liner_offset_(int index) {
+      if constexpr (D == 0)
+        return index * Get<0, Strides...>::value;
+      else
+        return (index % Get<D, Dims...>::value) * Get<D, Strides...>::value +
+               liner_offset_<D - 1>(index / Get<D, Dims...>::value);
+    }
+
+   public:
+    using shape_type = std::integer_sequence<int, Dims...>;
+    using strides_type = std::integer_sequence<int, Strides...>;
+
+   private:
+    // view left after fixing the first K indices
+    template <int K>
+    using sub_view_ = ndarray_view<Type, typename Drop<shape_type, K>::type,
+                                   typename Drop<strides_type, K>::type>;
+
+   public:
+
+    explicit ndarray_view(Type* data) : data_(data) {}
+
+    // a read/write view converts to a read only one
+    operator ndarray_view<const value_type_, shape_type, strides_type>()
+        const {
+      return ndarray_view<const value_type_, shape_type, strides_type>(data_);
+    }
+
+    Type* data() const { return data_; }
+    constexpr size_t size() const {
+      return GetFact<RANK - 1, Dims...>::value;
+    }
+    constexpr auto shape() const { return std::make_tuple(Dims...); }
+    constexpr auto strides() const { return std::make_tuple(Strides...); }
+    static constexpr bool is_contiguous() {
+      return std::is_same<strides_type, RowMajorStrides<Dims...>>::value;
+    }
+
+    // at(i, j, ...) : element for a full index, sub view for a partial one
+    template <typename... Int>
+    auto at(int i, Int... args) const
+        -> std::conditional_t<sizeof...(Int) + 1 == RANK, Type&,
+                              sub_view_<sizeof...(Int) + 1>> {
+      static_assert(sizeof...(Int) < RANK,
+                    "ndarray_view::at : too many indices");
+      if constexpr (sizeof...(Int) + 1 == RANK)
+        return data_[offset_<0>(i, args...)];
+      else
+        return sub_view_<sizeof...(Int) + 1>(data_ + offset_<0>(i, args...));
+    }
+
+    Type& linerAt(int index) const {
+      if constexpr (is_contiguous())
+        return data_[index];
+      else
+        return data_[liner_offset_<RANK - 1>(index)];
+    }
+
+    // reshape<NArgs...> : only for contiguous views, shares the buffer
+    template <int... NArgs>
+    ndarray_view<Type, std::integer_sequence<int, NArgs...>,
+                 RowMajorStrides<NArgs...>>
+    reshape() const {
+      static_assert(is_contiguous(),
+                    "ndarray_view::reshape : view must be contiguous, copy() "
+                    "it first");
+      static_assert((int)GetFact<sizeof...(NArgs) - 1, NArgs...>::value ==
+                        (int)GetFact<RANK - 1, Dims...>::value,
+                    "usage : reshape<NArgs...> number of elements of reshaped "
+                    "view equal to called view.");
+      return ndarray_view<Type, std::integer_sequence<int, NArgs...>,
+                          RowMajorStrides<NArgs...>>(data_);
+    }
+
+    // transpose<I1,I2,...,IN> : permute dimensions and strides
+    template <int... NArgs>
+    auto transpose() const {
+      static_assert(sizeof...(NArgs) == RANK,
+                    "Transpose don't match number of arguments.");
+      return ndarray_view<
+          Type, std::integer_sequence<int, Get<NArgs, Dims...>::value...>,
+          std::integer_sequence<int, Get<NArgs, Strides...>::value...>>(data_);
+    }
+
+   private:
+    template <int... Is>
+    auto reverse_transpose_(std::integer_sequence<int, Is...>) const {
+      return transpose<RANK - 1 - Is...>();
+    }
+
+    template <int I, int S, int E, int ST, int... Is>
+    auto slice_(std::integer_sequence<int, Is...>) const {
+      return ndarray_view<
+          Type,
+          std::integer_sequence<int, (Is == I ? (E - S) / ST
+                                              : Get<Is, Dims...>::value)...>,
+          std::integer_sequence<int, Get<Is, Strides...>::value *
+                                         (Is == I ? ST : 1)...>>(
+          data_ + S * Get<I, Strides...>::value);
+    }
+
+   public:
+    // reverse transpose
+    auto T() const {
+      return reverse_transpose_(std::make_integer_sequence<int, RANK>());
+    }
+
+    // sliced i-th[S, E) step is ST
+    template <int I, int S, int E, int ST>
+    auto slice() const {
+      static_assert(ST > 0, "ST must be ST > 0");
+      static_assert(0 <= S && S <= E && E <= Get<I, Dims...>::value,
+                    "ndarray_view::slice : [S, E) out of range");
+      return slice_<I, S, E, ST>(std::make_integer_sequence<int, RANK>());
+    }
+
+    // materialize into a freshly allocated contiguous ndarray
+    ndarrayPtr<value_type_, Dims...> copy() const {
+      auto ret = make_ndarray_ptr<value_type_, Dims...>();
+      copy_to(*ret);
+      return ret;
+    }
+
+    void copy_to(ndarray<value_type_, Dims...>& dst) const {
+      StridedCopy<shape_type, strides_type>::apply(
+          static_cast<const value_type_*>(data_), dst.data());
+    }
+
+   private:
+    Type* data_;
+  };
+
+  /**
+   * reshape an ndarrayPtr without copying.
+   *
+   * The returned pointer shares ownership (and the element buffer) of
+   * array, so writes through either are visible in both.
+   */
+  template <int... NArgs, typename Type, int... Dims>
+  ndarrayPtr<Type, NArgs...> reshape(const ndarrayPtr<Type, Dims...>& array) {
+    static_assert((int)GetFact<sizeof...(NArgs) - 1, NArgs...>::value ==
+                      (int)GetFact<sizeof...(Dims) - 1, Dims...>::value,
+                  "usage : reshape<NArgs...> number of elements of reshaped "
+                  "array equal to called ndarray.");
+    return ndarrayPtr<Type, NArgs...>(
+        array, reinterpret_cast<ndarray<Type, NArgs...>*>(array.get()));
+  }
+
+  template <typename Type, int... Dims, int... Strides>
+  std::ostream& operator<<(
+      std::ostream& os,
+      const ndarray_view<Type, std::integer_sequence<int, Dims...>,
+                         std::integer_sequence<int, Strides...>>& view) {
+    return os << *view.copy();
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_NDARRAY_VIEW_HPP
@@ -0,0 +1,167 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_POOLING_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_POOLING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include "ndarray.hpp"
+#include "thread_pool.hpp"
+
+namespace dpl {
+
+  //================================================================
+  // PoolIndex<WINDOW>::type
+  // smallest unsigned type holding a position inside a WINDOW sized window
+  template <int WINDOW>
+  struct PoolIndex {
+    using type = std::conditional_t<
+        WINDOW <= 256, std::uint8_t,
+        std::conditional_t<WINDOW <= 65536, std::uint16_t, std::uint32_t>>;
+  };
+  //================================================================
+
+  /**
+   * max pooling forward, no padding
+   * y[n, c, oy, ox] = max of the POOL_H x POOL_W window at
+   * (oy * STRIDE, ox * STRIDE); arg[n, c, oy, ox] = fy * POOL_W + fx of the
+   * first maximum, not recorded when pa is null. One pass over every
+   * (n, c) plane, parallel over N * C.
+   */
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE, int OUT_H, int OUT_W, typename Index>
+  void max_pool2d_forward_(const ndarray<Type, N, C, H, W>& x,
+                           ndarray<Type, N, C, OUT_H, OUT_W>& y, Index* pa) {
+    static_assert(OUT_H == (H - POOL_H) / STRIDE + 1 &&
+                      OUT_W == (W - POOL_W) / STRIDE + 1,
+                  "max_pool2d_forward : output size mismatch");
+    const Type* px = x.data();
+    Type* py = y.data();
+    parallel_for(0, N * C, [&](int lo, int hi) {
+      for (int p = lo; p < hi; p++) {
+        const Type* img = px + p * H * W;
+        Type* out = py + p * OUT_H * OUT_W;
+        Index* idx = pa ? pa + p * OUT_H * OUT_W : nullptr;
+        for (int oy = 0; oy < OUT_H; oy++)
+          for (int ox = 0; ox < OUT_W; ox++) {
+            const Type* window = img + oy * STRIDE * W + ox * STRIDE;
+            Type m = window[0];
+            int k = 0;
+            for (int fy = 0; fy < POOL_H; fy++)
+              for (int fx = 0; fx < POOL_W; fx++)
+                if (m < window[fy * W + fx]) {
+                  m = window[fy * W + fx];
+                  k = fy * POOL_W + fx;
+                }
+            out[oy * OUT_W + ox] = m;
+            if (idx) idx[oy * OUT_W + ox] = (Index)k;
+          }
+      }
+    }, PARALLEL_GRAIN / (H * W));
+  }
+
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE, int OUT_H, int OUT_W, typename Index>
+  void max_pool2d_forward(const ndarray<Type, N, C, H, W>& x,
+                          ndarray<Type, N, C, OUT_H, OUT_W>& y,
+                          ndarray<Index, N, C, OUT_H, OUT_W>& arg) {
+    max_pool2d_forward_<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(x, y,
+                                                                  arg.data());
+  }
+
+  // inference : max only
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE, int OUT_H, int OUT_W>
+  void max_pool2d_forward(const ndarray<Type, N, C, H, W>& x,
+                          ndarray<Type, N, C, OUT_H, OUT_W>& y) {
+    max_pool2d_forward_<Type, N, C, H, W, POOL_H, POOL_W, STRIDE>(
+        x, y, (std::uint8_t*)nullptr);
+  }
+
+  /**
+   * max pooling backward : dx is zero except at the argmax of every
+   * window, which receives dy (summed when windows overlap)
+   */
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE, int OUT_H, int OUT_W, typename Index>
+  void max_pool2d_backward(const ndarray<Type, N, C, OUT_H, OUT_W>& dy,
+                           const ndarray<Index, N, C, OUT_H, OUT_W>& arg,
+                           ndarray<Type, N, C, H, W>& dx) {
+    const Type* pdy = dy.data();
+    const Index* pa = arg.data();
+    Type* pdx = dx.data();
+    parallel_for(0, N * C, [&](int lo, int hi) {
+      for (int p = lo; p < hi; p++) {
+        Type* img = pdx + p * H * W;
+        const Type* g = pdy + p * OUT_H * OUT_W;
+        const Index* idx = pa + p * OUT_H * OUT_W;
+        std::fill(img, img + H * W, (Type)0);
+        for (int oy = 0; oy < OUT_H; oy++)
+          for (int ox = 0; ox < OUT_W; ox++) {
+            const int k = idx[oy * OUT_W + ox];
+            img[(oy * STRIDE + k / POOL_W) * W + ox * STRIDE + k % POOL_W] +=
+                g[oy * OUT_W + ox];
+          }
+      }
+    }, PARALLEL_GRAIN / (H * W));
+  }
+
+  /**
+   * average pooling forward, no padding
+   * y[n, c, oy, ox] = mean of the POOL_H x POOL_W window
+   */
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE, int OUT_H, int OUT_W>
+  void avg_pool2d_forward(const ndarray<Type, N, C, H, W>& x,
+                          ndarray<Type, N, C, OUT_H, OUT_W>& y) {
+    static_assert(OUT_H == (H - POOL_H) / STRIDE + 1 &&
+                      OUT_W == (W - POOL_W) / STRIDE + 1,
+                  "avg_pool2d_forward : output size mismatch");
+    const Type scale = (Type)1 / (POOL_H * POOL_W);
+    const Type* px = x.data();
+    Type* py = y.data();
+    parallel_for(0, N * C, [&](int lo, int hi) {
+      for (int p = lo; p < hi; p++) {
+        const Type* img = px + p * H * W;
+        Type* out = py + p * OUT_H * OUT_W;
+        for (int oy = 0; oy < OUT_H; oy++)
+          for (int ox = 0; ox < OUT_W; ox++) {
+            const Type* window = img + oy * STRIDE * W + ox * STRIDE;
+            Type s = 0;
+            for (int fy = 0; fy < POOL_H; fy++)
+              for (int fx = 0; fx < POOL_W; fx++) s += window[fy * W + fx];
+            out[oy * OUT_W + ox] = s * scale;
+          }
+      }
+    }, PARALLEL_GRAIN / (H * W));
+  }
+
+  /**
+   * average pooling backward : every window spreads dy / (POOL_H * POOL_W)
+   * over its inputs
+   */
+  template <typename Type, int N, int C, int H, int W, int POOL_H, int POOL_W,
+            int STRIDE, int OUT_H, int OUT_W>
+  void avg_pool2d_backward(const ndarray<Type, N, C, OUT_H, OUT_W>& dy,
+                           ndarray<Type, N, C, H, W>& dx) {
+    const Type scale = (Type)1 / (POOL_H * POOL_W);
+    const Type* pdy = dy.data();
+    Type* pdx = dx.data();
+    parallel_for(0, N * C, [&](int lo, int hi) {
+      for (int p = lo; p < hi; p++) {
+        Type* img = pdx + p * H * W;
+        const Type* g = pdy + p * OUT_H * OUT_W;
+        std::fill(img, img + H * W, (Type)0);
+        for (int oy = 0; oy < OUT_H; oy++)
+          for (int ox = 0; ox < OUT_W; ox++) {
+            const Type v = g[oy * OUT_W + ox] * scale;
+            Type* window = img + oy * STRIDE * W + ox * STRIDE;
+            for (int fy = 0; fy < POOL_H; fy++)
+              for (int fx = 0; fx < POOL_W; fx++) window[fy * W + fx] += v;
+          }
+      }
+    }, PARALLEL_GRAIN / (H * W));
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_POOLING_HPP
@@ -6,6 +6,10 @@
 #define DEEP_LEARNING_FROM_SCRATCH_PRIMITIVE_HPP
 
 #include "primitive/ndarray.hpp"
+#include "primitive/bitmask.hpp"
+#include "primitive/convolution.hpp"
+#include "primitive/pooling.hpp"
+#include "primitive/random.hpp"
 #include "primitive/parameters.hpp"
 #include <memory>
 
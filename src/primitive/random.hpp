@@ -0,0 +1,209 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_RANDOM_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_RANDOM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include "thread_pool.hpp"
+
+namespace dpl {
+
+  // 32 bit words produced by one philox4x32_block call
+  constexpr int PHILOX_BLOCK = 64;
+  // philox blocks generated together by one parallel_for chunk
+  constexpr int PHILOX_GRAIN = 1 << 7;
+
+  /**
+   * Philox4x32-10 counter based generator, 16 counters at once.
+   *
+   * out[j * 16 + l] = word j of philox((counter + l, stream), key). Every
+   * lane is independent, so the rounds vectorize, and any block can be
+   * produced without the ones before it, so bulk generation splits over
+   * threads without changing the stream. Different streams of one key
+   * never overlap.
+   */
+  inline void philox4x32_block(std::uint64_t counter, std::uint64_t key,
+                               std::uint32_t* out, std::uint64_t stream = 0) {
+    constexpr int L = PHILOX_BLOCK / 4;
+    constexpr std::uint64_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    std::uint32_t c0[L], c1[L], c2[L], c3[L];
+    for (int l = 0; l < L; l++) {
+      c0[l] = (std::uint32_t)(counter + l);
+      c1[l] = (std::uint32_t)((counter + l) >> 32);
+      c2[l] = (std::uint32_t)stream;
+      c3[l] = (std::uint32_t)(stream >> 32);
+    }
+    std::uint32_t k0 = (std::uint32_t)key, k1 = (std::uint32_t)(key >> 32);
+    for (int r = 0; r < 10; r++) {
+      for (int l = 0; l < L; l++) {
+        const std::uint64_t p0 = M0 * c0[l], p1 = M1 * c2[l];
+        const std::uint32_t n0 = (std::uint32_t)(p1 >> 32) ^ c1[l] ^ k0;
+        const std::uint32_t n2 = (std::uint32_t)(p0 >> 32) ^ c3[l] ^ k1;
+        c1[l] = (std::uint32_t)p1;
+        c3[l] = (std::uint32_t)p0;
+        c0[l] = n0;
+        c2[l] = n2;
+      }
+      k0 += 0x9E3779B9;
+      k1 += 0xBB67AE85;
+    }
+    std::copy(c0, c0 + L, out);
+    std::copy(c1, c1 + L, out + L);
+    std::copy(c2, c2 + L, out + 2 * L);
+    std::copy(c3, c3 + L, out + 3 * L);
+  }
+
+  /**
+   * philox_engine
+   *
+   * UniformRandomBitGenerator over philox4x32_block, usable with the
+   * std distributions. reserve(n) hands out n blocks of the stream for
+   * bulk generation (random_uniform, dropout masks) and skips them.
+   * (seed, stream) fixes the whole sequence.
+   */
+  class philox_engine {
+   public:
+    using result_type = std::uint32_t;
+
+    explicit philox_engine(std::uint64_t seed = 0, std::uint64_t stream = 0)
+        : key_(seed), stream_(stream) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFF; }
+
+    result_type operator()() {
+      if (pos_ == PHILOX_BLOCK) {
+        philox4x32_block(reserve(1), key_, buf_, stream_);
+        pos_ = 0;
+      }
+      return buf_[pos_++];
+    }
+
+    void seed(std::uint64_t seed, std::uint64_t stream = 0) {
+      key_ = seed;
+      stream_ = stream;
+      counter_ = 0;
+      pos_ = PHILOX_BLOCK;
+    }
+
+    /**
+     * @return counter of the first of n blocks, which the engine will not
+     * produce itself.
+     */
+    std::uint64_t reserve(std::uint64_t n) {
+      const std::uint64_t ret = counter_;
+      counter_ += n * (PHILOX_BLOCK / 4);
+      return ret;
+    }
+
+    std::uint64_t key() const { return key_; }
+    std::uint64_t stream() const { return stream_; }
+
+   private:
+    std::uint64_t key_, stream_;
+    std::uint64_t counter_ = 0;
+    int pos_ = PHILOX_BLOCK;
+    std::uint32_t buf_[PHILOX_BLOCK];
+  };
+
+  //================================================================
+  // RandomSeed_
+  // global seed; generation counts set_random_seed calls, next_stream
+  // numbers the threads that drew since the last one
+  struct RandomSeed_ {
+    std::atomic<std::uint64_t> seed;
+    std::atomic<std::uint64_t> generation{0};
+    std::atomic<std::uint64_t> next_stream{0};
+  };
+  inline RandomSeed_& random_seed_() {
+    static RandomSeed_ state{
+        {(std::uint64_t)std::random_device{}() << 32 |
+         std::random_device{}()}};
+    return state;
+  }
+  inline std::uint64_t& random_generation_() {
+    thread_local std::uint64_t generation = (std::uint64_t)-1;
+    return generation;
+  }
+  //================================================================
+
+  /**
+   * Generator shared by every ndarray and layer on the calling thread.
+   *
+   * Every thread draws from its own stream of the global seed
+   * (set_random_seed), taken on its first use after the seed was set.
+   * Weight initialization, Dropout masks and batch sampling all go
+   * through it.
+   *
+   * @return thread local philox_engine.
+   */
+  inline philox_engine& random_engine() {
+    thread_local philox_engine engine;
+    auto& state = random_seed_();
+    if (random_generation_() != state.generation) {
+      random_generation_() = state.generation;
+      engine.seed(state.seed, state.next_stream++);
+    }
+    return engine;
+  }
+
+  /**
+   * Reseed every thread's random_engine(). The calling thread restarts
+   * stream 0 at once, so a single threaded driver reproduces the same
+   * weights, masks and batches bit for bit; other threads take streams
+   * 1, 2, ... in the order they next draw.
+   */
+  inline void set_random_seed(std::uint64_t seed) {
+    auto& state = random_seed_();
+    state.seed = seed;
+    state.next_stream = 0;
+    state.generation++;
+    random_engine();
+  }
+
+  // seed of the current generation, to log next to benchmark results
+  inline std::uint64_t random_seed() { return random_seed_().seed; }
+
+  /**
+   * @return engine keyed by the next 64 bits of random_engine(), for
+   * consumers whose draws must not depend on the thread they run on.
+   */
+  inline philox_engine random_fork() {
+    const std::uint64_t hi = random_engine()();
+    return philox_engine(hi << 32 | random_engine()());
+  }
+
+  // uniform float in [0, 1) from the top 24 bits of a word
+  inline float uniform_float(std::uint32_t v) {
+    return (float)(v >> 8) * (1.0f / (1 << 24));
+  }
+
+  /**
+   * out[0, n) = uniform floats in [0, 1) from the next blocks of engine
+   * (random_engine() by default), generated in parallel.
+   */
+  template <typename Type>
+  void random_uniform(Type* out, int n, philox_engine& engine) {
+    const int blocks = (n + PHILOX_BLOCK - 1) / PHILOX_BLOCK;
+    const std::uint64_t counter = engine.reserve(blocks);
+    const std::uint64_t key = engine.key(), stream = engine.stream();
+    parallel_for(0, blocks, [=](int lo, int hi) {
+      std::uint32_t bits[PHILOX_BLOCK];
+      for (int b = lo; b < hi; b++) {
+        philox4x32_block(counter + (std::uint64_t)b * (PHILOX_BLOCK / 4), key,
+                         bits, stream);
+        const int m = std::min(PHILOX_BLOCK, n - b * PHILOX_BLOCK);
+        for (int i = 0; i < m; i++)
+          out[b * PHILOX_BLOCK + i] = (Type)uniform_float(bits[i]);
+      }
+    }, PHILOX_GRAIN);
+  }
+  template <typename Type>
+  void random_uniform(Type* out, int n) {
+    random_uniform(out, n, random_engine());
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_RANDOM_HPP
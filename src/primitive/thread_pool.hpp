@@ -0,0 +1,259 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_THREAD_POOL_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dpl {
+
+  /**
+   * ThreadPool
+   *
+   * Work-stealing pool. Every worker owns a deque; it pops its own tasks
+   * LIFO and steals from the front of the others when it runs dry. Tasks
+   * submitted from outside the pool are dealt round robin.
+   *
+   * Threads blocked in parallel_for keep running queued tasks while they
+   * wait, so parallel_for can be nested.
+   */
+  class ThreadPool {
+   public:
+    // n : number of threads taking part in parallel_for, caller included
+    explicit ThreadPool(int n) : size_(std::max(n, 1)) {
+      for (int i = 0; i < size_ - 1; i++)
+        queues_.emplace_back(std::make_unique<queue_>());
+      for (int i = 0; i < size_ - 1; i++)
+        workers_.emplace_back([this, i] { work_(i); });
+    }
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      for (auto& t : workers_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return size_; }
+
+    void submit(std::function<void()> task) {
+      if (queues_.empty()) {
+        task();
+        return;
+      }
+      int i = index_().first == this ? index_().second
+                                      : next_++ % (int)queues_.size();
+      {
+        std::lock_guard<std::mutex> lock(queues_[i]->mutex);
+        queues_[i]->tasks.push_back(std::move(task));
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+      }
+      cv_.notify_one();
+    }
+
+    // run one queued task on the calling thread, false if there was none
+    bool run_one() {
+      std::function<void()> task;
+      int self = index_().first == this ? index_().second : 0;
+      if (!pop_(self, task)) return false;
+      task();
+      return true;
+    }
+
+    /**
+     * f(lo, hi) over [begin, end) split into chunks of at least grain
+     * elements; blocks until every chunk has run. Runs inline when the
+     * range is a single chunk. The first exception thrown by f is
+     * rethrown here.
+     */
+    template <class F>
+    void parallel_for(int begin, int end, F f, int grain = 1) {
+      const int n = end - begin;
+      if (n <= 0) return;
+      grain = std::max(grain, 1);
+      const int chunks =
+          std::min((n + grain - 1) / grain, size_ * CHUNKS_PER_THREAD);
+      if (chunks <= 1 || size_ == 1) {
+        f(begin, end);
+        return;
+      }
+
+      auto job = std::make_shared<job_>();
+      job->chunks = chunks;
+      auto run = [job, begin, n, chunks, &f] {
+        int c;
+        while ((c = job->next++) < chunks) {
+          if (!job->failed) try {
+              f(begin + (int)((long long)n * c / chunks),
+                begin + (int)((long long)n * (c + 1) / chunks));
+            } catch (...) {
+              std::lock_guard<std::mutex> lock(job->mutex);
+              if (!job->failed.exchange(true))
+                job->error = std::current_exception();
+            }
+          job->done++;
+        }
+      };
+      const int helpers = std::min(size_ - 1, chunks - 1);
+      for (int i = 0; i < helpers; i++) submit(run);
+      run();
+      while (job->done < chunks)
+        if (!run_one()) std::this_thread::yield();
+      if (job->failed) std::rethrow_exception(job->error);
+    }
+
+   private:
+    static constexpr int CHUNKS_PER_THREAD = 4;
+
+    struct queue_ {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    struct job_ {
+      std::atomic<int> next{0};
+      std::atomic<int> done{0};
+      std::atomic<bool> failed{false};
+      int chunks = 0;
+      std::mutex mutex;
+      std::exception_ptr error;
+    };
+
+    // (pool, worker index) of the calling thread
+    static std::pair<const ThreadPool*, int>& index_() {
+      thread_local std::pair<const ThreadPool*, int> index{nullptr, -1};
+      return index;
+    }
+
+    // own queue from the back, then steal from the front of the others
+    bool pop_(int self, std::function<void()>& task) {
+      if (queues_.empty()) return false;
+      {
+        std::lock_guard<std::mutex> lock(queues_[self]->mutex);
+        auto& q = queues_[self]->tasks;
+        if (!q.empty()) {
+          task = std::move(q.back());
+          q.pop_back();
+          return taken_();
+        }
+      }
+      for (int k = 1; k < (int)queues_.size(); k++) {
+        auto& victim = *queues_[(self + k) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+          task = std::move(victim.tasks.front());
+          victim.tasks.pop_front();
+          return taken_();
+        }
+      }
+      return false;
+    }
+
+    bool taken_() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+      return true;
+    }
+
+    void work_(int i) {
+      index_() = {this, i};
+      std::function<void()> task;
+      while (true) {
+        if (pop_(i, task)) {
+          task();
+          task = nullptr;
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ == 0) return;
+      }
+    }
+
+    const int size_;
+    std::vector<std::unique_ptr<queue_>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<int> next_{0};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int pending_ = 0;
+    bool stop_ = false;
+  };
+
+  // default number of threads : $DPL_NUM_THREADS, else the number of cores
+  inline int default_num_threads() {
+    if (const char* env = std::getenv("DPL_NUM_THREADS")) {
+      int n = std::atoi(env);
+      if (n > 0) return n;
+    }
+    return std::max(1, (int)std::thread::hardware_concurrency());
+  }
+
+  inline std::unique_ptr<ThreadPool>& thread_pool_instance_() {
+    static std::unique_ptr<ThreadPool> pool =
+        std::make_unique<ThreadPool>(default_num_threads());
+    return pool;
+  }
+
+  // process wide pool used by the kernels
+  inline ThreadPool& thread_pool() { return *thread_pool_instance_(); }
+
+  inline int num_threads() { return thread_pool().size(); }
+
+  // resize the process wide pool; must not race with running kernels
+  inline void set_num_threads(int n) {
+    auto& pool = thread_pool_instance_();
+    if (pool->size() == std::max(n, 1)) return;
+    pool.reset();
+    pool = std::make_unique<ThreadPool>(n);
+  }
+
+  // thread_pool().parallel_for
+  template <class F>
+  void parallel_for(int begin, int end, F f, int grain = 1) {
+    thread_pool().parallel_for(begin, end, std::move(f), grain);
+  }
+
+  /**
+   * reduce [begin, end) : f(lo, hi) reduces one chunk, combine(acc, v)
+   * folds chunk results in index order. Chunks only depend on grain, so
+   * the result does not change with the number of threads.
+   */
+  template <typename T, class F, class Combine>
+  T parallel_reduce(int begin, int end, T init, F f, Combine combine,
+                    int grain) {
+    const int n = end - begin;
+    if (n <= 0) return init;
+    grain = std::max(grain, 1);
+    const int chunks = (n + grain - 1) / grain;
+    if (chunks == 1) return combine(init, f(begin, end));
+    std::vector<T> partial(chunks);
+    parallel_for(0, chunks, [&](int lo, int hi) {
+      for (int c = lo; c < hi; c++)
+        partial[c] =
+            f(begin + c * grain, std::min(end, begin + (c + 1) * grain));
+    });
+    for (const T& v : partial) init = combine(init, v);
+    return init;
+  }
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_THREAD_POOL_HPP
@@ -0,0 +1,165 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_PREFETCHER_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_PREFETCHER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../primitive/ndarray.hpp"
+#include "sampler.hpp"
+
+namespace dpl {
+
+  /**
+   * consumer side counters of a Prefetcher
+   * stalls : batches that were not ready when asked for
+   */
+  struct PrefetchStats {
+    long batches = 0;
+    long stalls = 0;
+    double stall_seconds = 0;
+  };
+
+  inline std::ostream& operator<<(std::ostream& os, const PrefetchStats& s) {
+    os << "batches: " << s.batches << ", stalls: " << s.stalls
+       << ", stall time: " << s.stall_seconds << " s";
+    return os;
+  }
+
+  template <int BATCH_SIZE, class Input, class Label>
+  class Prefetcher;
+
+  /**
+   * Prefetcher<BATCH_SIZE, ndarray<...> inputs, ndarray<...> labels>
+   *
+   * Background batch assembly for the Trainer. Producer threads take
+   * index batches from an EpochSampler and gather the rows into a bounded
+   * ring of preallocated buffers, up to depth batches ahead of the
+   * consumer. Batches come out in sampler order whatever the number of
+   * producers.
+   */
+  template <int BATCH_SIZE, typename InputType, int N, int... InputDims,
+            typename LabelType, int... LabelDims>
+  class Prefetcher<BATCH_SIZE, ndarray<InputType, N, InputDims...>,
+                   ndarray<LabelType, N, LabelDims...>> {
+   public:
+    using input = ndarrayPtr<InputType, BATCH_SIZE, InputDims...>;
+    using label = ndarrayPtr<LabelType, BATCH_SIZE, LabelDims...>;
+
+    /**
+     * @param depth batches prepared ahead of the consumer (>= 1)
+     * @param producers producer threads (>= 1)
+     */
+    Prefetcher(ndarrayPtr<InputType, N, InputDims...> x,
+               ndarrayPtr<LabelType, N, LabelDims...> t, int depth = 2,
+               int producers = 1)
+        : x_(x), t_(t), depth_(std::max(depth, 1)) {
+      // one more slot than depth : the batch the consumer still reads
+      slots_.resize(depth_ + 1);
+      for (auto& slot : slots_) {
+        slot.x = make_ndarray_ptr<InputType, BATCH_SIZE, InputDims...>();
+        slot.t = make_ndarray_ptr<LabelType, BATCH_SIZE, LabelDims...>();
+        slot.index.resize(BATCH_SIZE);
+      }
+      for (int i = 0; i < std::max(producers, 1); i++)
+        producers_.emplace_back([this] { produce_(); });
+    }
+
+    ~Prefetcher() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      for (auto& t : producers_) t.join();
+    }
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    /**
+     * Waits for the next batch. The buffers stay valid, and are not
+     * refilled, until the following call.
+     */
+    std::pair<input, label> next() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      slot_& slot = slots_[consumed_ % slots_.size()];
+      if (slot.ready != consumed_) {
+        const auto start = std::chrono::steady_clock::now();
+        cv_.wait(lock, [&] { return slot.ready == consumed_; });
+        stats_.stalls++;
+        stats_.stall_seconds += std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+      }
+      consumed_++;
+      stats_.batches++;
+      lock.unlock();
+      // the previous batch's slot is free again
+      cv_.notify_all();
+      return std::make_pair(slot.x, slot.t);
+    }
+
+    PrefetchStats stats() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return stats_;
+    }
+
+    int depth() const { return depth_; }
+
+   private:
+    struct slot_ {
+      input x;
+      label t;
+      std::vector<int> index;
+      // sequence number of the batch held, -1 while empty or being filled
+      long ready = -1;
+    };
+
+    void produce_() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true) {
+        // slot of batch seq is free once batch seq - slots has been
+        // released, i.e. the consumer asked for the batch after it
+        cv_.wait(lock, [this] {
+          return stop_ || produced_ < consumed_ + depth_;
+        });
+        if (stop_) return;
+        const long seq = produced_++;
+        slot_& slot = slots_[seq % slots_.size()];
+        slot.ready = -1;
+        const int* index = sampler_.next();
+        std::copy(index, index + BATCH_SIZE, slot.index.begin());
+        lock.unlock();
+
+        x_->template gather<BATCH_SIZE>(slot.index.data(), *slot.x);
+        t_->template gather<BATCH_SIZE>(slot.index.data(), *slot.t);
+
+        lock.lock();
+        slot.ready = seq;
+        cv_.notify_all();
+      }
+    }
+
+    ndarrayPtr<InputType, N, InputDims...> x_;
+    ndarrayPtr<LabelType, N, LabelDims...> t_;
+    const int depth_;
+    EpochSampler<N, BATCH_SIZE> sampler_;
+    std::vector<slot_> slots_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    // batches handed to producers / to the consumer so far
+    long produced_ = 0, consumed_ = 0;
+    bool stop_ = false;
+    PrefetchStats stats_;
+    std::vector<std::thread> producers_;
+  };
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_PREFETCHER_HPP
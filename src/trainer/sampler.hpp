@@ -0,0 +1,68 @@
+#ifndef DEEP_LEARNING_FROM_SCRATCH_SAMPLER_HPP
+#define DEEP_LEARNING_FROM_SCRATCH_SAMPLER_HPP
+
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+#include "../primitive/ndarray.hpp"
+#include "../primitive/random.hpp"
+
+namespace dpl {
+
+  /**
+   * EpochSampler<N, BATCH_SIZE>
+   *
+   * Minibatch indices over N samples without replacement: one shuffled
+   * permutation per epoch, cut into N / BATCH_SIZE batches (the last
+   * N % BATCH_SIZE samples of a permutation are skipped). Shuffling draws
+   * from an engine of its own, seeded from the constructing thread's
+   * random_engine(): set_random_seed fixes the batch order, whichever
+   * thread calls next(). Rows are then copied with ndarray::gather.
+   */
+  template <int N, int BATCH_SIZE>
+  class EpochSampler {
+    static_assert(0 < BATCH_SIZE && BATCH_SIZE <= N,
+                  "EpochSampler : 0 < BATCH_SIZE <= N");
+
+   public:
+    static constexpr int BATCHES_PER_EPOCH = N / BATCH_SIZE;
+
+    EpochSampler() : EpochSampler(random_fork()) {}
+    explicit EpochSampler(const philox_engine& engine)
+        : index_(N), engine_(engine) {
+      std::iota(index_.begin(), index_.end(), 0);
+    }
+
+    /**
+     * @return BATCH_SIZE sample indices, valid until the next call.
+     * Starts a new epoch (and reshuffles) when the current one is used up.
+     */
+    const int* next() {
+      if (batch_ == BATCHES_PER_EPOCH) {
+        batch_ = 0;
+        epoch_++;
+      }
+      if (batch_ == 0) shuffle_();
+      return index_.data() + BATCH_SIZE * batch_++;
+    }
+
+    // index of the epoch the last batch came from
+    int epoch() const { return epoch_; }
+
+   private:
+    void shuffle_() {
+      for (int i = N - 1; i > 0; i--) {
+        std::uniform_int_distribution<int> pick(0, i);
+        std::swap(index_[i], index_[pick(engine_)]);
+      }
+    }
+
+    std::vector<int> index_;
+    philox_engine engine_;
+    int batch_ = 0, epoch_ = 0;
+  };
+
+}  // namespace dpl
+
+#endif  // DEEP_LEARNING_FROM_SCRATCH_SAMPLER_HPP
@@ -9,6 +9,7 @@
 #include "../src/network/network.hpp"
 #include "../src/optimizer/optimizer.hpp"
 #include "../src/primitive/ndarray.hpp"
+#include "prefetcher.hpp"
 
 namespace dpl {
   template <int BATCH_SIZE, int EVALUEATE_SAMPLE_NUM_PER_EPOCH, class NETWORK,
@@ -16,20 +17,30 @@ namespace dpl {
             class TEST_INPUT, class TEST_LABEL>
   class Trainer;
 
+  /**
+   * labels are either one-hot float rows [N, M] or class indices [N] of
+   * any integer type (e.g. uint8_t)
+   *
+   * Training batches are assembled in the background by a Prefetcher,
+   * prefetch_depth batches ahead of the training step.
+   */
   template <int BATCH_SIZE, int EVALUEATE_SAMPLE_NUM_PER_EPOCH, class... Layers,
-            class Optimizer, int... TrainInputArgs, int... TrainLabelArgs,
-            int... TestInputArgs, int... TestLabelArgs>
-  class Trainer<
-      BATCH_SIZE, EVALUEATE_SAMPLE_NUM_PER_EPOCH, NetworkPtr<Layers...>,
-      Optimizer, ndarrayPtr<float, TrainInputArgs...>,
-      ndarrayPtr<float, TrainLabelArgs...>, ndarrayPtr<float, TestInputArgs...>,
-      ndarrayPtr<float, TestLabelArgs...>> {
+            class Optimizer, int... TrainInputArgs, typename TrainLabelType,
+            int... TrainLabelArgs, int... TestInputArgs, typename TestLabelType,
+            int... TestLabelArgs>
+  class Trainer<BATCH_SIZE, EVALUEATE_SAMPLE_NUM_PER_EPOCH,
+                NetworkPtr<Layers...>, Optimizer,
+                ndarrayPtr<float, TrainInputArgs...>,
+                ndarrayPtr<TrainLabelType, TrainLabelArgs...>,
+                ndarrayPtr<float, TestInputArgs...>,
+                ndarrayPtr<TestLabelType, TestLabelArgs...>> {
    public:
     Trainer(NetworkPtr<Layers...> network, const Optimizer& optimizer,
             ndarrayPtr<float, TrainInputArgs...> x_train,
-            ndarrayPtr<float, TrainLabelArgs...> t_train,
+            ndarrayPtr<TrainLabelType, TrainLabelArgs...> t_train,
             ndarrayPtr<float, TestInputArgs...> x_test,
-            ndarrayPtr<float, TestLabelArgs...> t_test, int epochs)
+            ndarrayPtr<TestLabelType, TestLabelArgs...> t_test, int epochs,
+            int prefetch_depth = 2)
         : epochs_(epochs) {
       network_ = network;
       x_train_ = x_train;
@@ -38,41 +49,39 @@ namespace dpl {
       x_test_ = x_test;
       t_test_ = t_test;
 
-      iter_per_epoch_ =
-          std::max(Get<0, TrainInputArgs...>::value / BATCH_SIZE, 1);
+      iter_per_epoch_ = EpochSampler<TRAIN_NUM, BATCH_SIZE>::BATCHES_PER_EPOCH;
       max_iter_ = epochs_ * iter_per_epoch_;
       current_iter_ = 0;
       current_epoch_ = 0;
+
+      prefetcher_ = std::make_unique<Batches>(x_train, t_train, prefetch_depth);
     }
 
     void train_step() {
-      constexpr int TRAIN_NUM = Get<0, TrainInputArgs...>::value;
-      auto mask = make_ndarray_ptr<bool, TRAIN_NUM>();
-      mask->template random_mask<BATCH_SIZE>();
-
-      auto x_batch = x_train_->template choice<BATCH_SIZE>(*mask);
-      auto t_batch = t_train_->template choice<BATCH_SIZE>(*mask);
+      auto batch = prefetcher_->next();
+      auto& x_batch = batch.first;
+      auto& t_batch = batch.second;
 
-      network_->gradient(x_batch, t_batch);
+      // loss of the forward pass the gradients come from, before the update
+      float loss = network_->forward_backward(x_batch, t_batch);
       optimizer_.update(*network_);
 
-      float loss = network_->loss(x_batch, t_batch);
-      std::vector<float> train_loss_list;
-      train_loss_list.emplace_back(loss);
+      train_loss_list_.emplace_back(loss);
       std::cout << "train loss : " << loss << std::endl;
 
       if (current_iter_ % iter_per_epoch_ == 0) {
+        constexpr int EVAL_NUM = EVALUEATE_SAMPLE_NUM_PER_EPOCH;
         current_epoch_++;
 
         auto x_train_sample_ =
-            x_train_->template slice<0, 0, EVALUEATE_SAMPLE_NUM_PER_EPOCH, 1>();
+            x_train_->view().template slice<0, 0, EVAL_NUM, 1>();
         auto t_train_sample_ =
-            t_train_->template slice<0, 0, EVALUEATE_SAMPLE_NUM_PER_EPOCH, 1>();
+            t_train_->view().template slice<0, 0, EVAL_NUM, 1>();
 
         auto x_test_sample_ =
-            x_test_->template slice<0, 0, EVALUEATE_SAMPLE_NUM_PER_EPOCH, 1>();
+            x_test_->view().template slice<0, 0, EVAL_NUM, 1>();
         auto t_test_sample_ =
-            t_test_->template slice<0, 0, EVALUEATE_SAMPLE_NUM_PER_EPOCH, 1>();
+            t_test_->view().template slice<0, 0, EVAL_NUM, 1>();
 
         float train_acc = network_->template accuracy<BATCH_SIZE>(
             x_train_sample_, t_train_sample_);
@@ -95,15 +104,23 @@ namespace dpl {
       std::cout << "=============== Final Test Accuracy ==============="
                 << std::endl;
       std::cout << "test acc: " << test_acc << std::endl;
+      std::cout << "prefetch : " << prefetch_stats() << std::endl;
     }
 
+    PrefetchStats prefetch_stats() const { return prefetcher_->stats(); }
+
    private:
+    static constexpr int TRAIN_NUM = Get<0, TrainInputArgs...>::value;
+    using Batches = Prefetcher<BATCH_SIZE, ndarray<float, TrainInputArgs...>,
+                               ndarray<TrainLabelType, TrainLabelArgs...>>;
+
     NetworkPtr<Layers...> network_;
     Optimizer optimizer_;
     ndarrayPtr<float, TrainInputArgs...> x_train_;
-    ndarrayPtr<float, TrainLabelArgs...> t_train_;
+    ndarrayPtr<TrainLabelType, TrainLabelArgs...> t_train_;
     ndarrayPtr<float, TestInputArgs...> x_test_;
-    ndarrayPtr<float, TestLabelArgs...> t_test_;
+    ndarrayPtr<TestLabelType, TestLabelArgs...> t_test_;
+    std::unique_ptr<Batches> prefetcher_;
     int epochs_, evaluate_sample_num_per_epoch_;
 
     int iter_per_epoch_, max_iter_, current_iter_, current_epoch_;
@@ -6,6 +6,8 @@
 #include <gtest/gtest.h>
 #include <algorithm>
 #include <iostream>
+#include <thread>
+#include <vector>
 #include "../src/primitive/primitive.hpp"
 
 using namespace dpl;
@@ -25,6 +27,21 @@ TEST(LAYER_TEST, RELU) {
   for (int i = 0; i < dx->size(); i++) {
     ASSERT_FLOAT_EQ(in->linerAt(i) > 0.0 ? out->linerAt(i) : 0, dx->linerAt(i));
   }
+
+  // in place : the argument buffer comes back overwritten
+  auto buf = make_ndarray_ptr<float, 100, 100>();
+  *buf = *in;
+  ASSERT_EQ(buf, relu.forward_inplace(buf));
+  ASSERT_TRUE(nearly(*out, *buf, 1e-3f));
+  ASSERT_EQ(buf, relu.backward_inplace(buf));
+  ASSERT_TRUE(nearly(*dx, *buf, 1e-3f));
+
+  // inference keeps no mask
+  const int kept = relu.mask->count();
+  auto neg = make_ndarray_ptr<float, 100, 100>();
+  neg->fill(1);
+  ASSERT_TRUE(nearly(*neg, *relu.infer(neg), 1e-7f));
+  ASSERT_EQ(kept, relu.mask->count());
 }
 
 TEST(LAYER_TEST, AFFINE) {
@@ -40,9 +57,20 @@ TEST(LAYER_TEST, DROPOUT) {
   dropout.set_dropout_ratio(0.5);
 
   auto in = make_ndarray_ptr<float, 100, 20, 10>();
+  in->fill(1);
   ndarrayPtr<float, 100, 20, 10> out = dropout.forward(in);
   ndarrayPtr<float, 100, 20, 10> dx = dropout.backward(out);
 
+  // the packed mask keeps about half of the elements, the same ones in
+  // forward and backward
+  const int kept = dropout.mask->count();
+  ASSERT_LT(9000, kept);
+  ASSERT_GT(11000, kept);
+  for (int i = 0; i < (int)out->size(); i++) {
+    ASSERT_EQ(dropout.mask->test(i) ? 1.0f : 0.0f, out->linerAt(i));
+    ASSERT_EQ(out->linerAt(i), dx->linerAt(i));
+  }
+
   //  ndarrayPtr<float, 100, 20, 10> out_f = dropout.forward(in, false);
   //  ndarrayPtr<float, 100, 20, 10> dx_f = dropout.backward(out_f);
 }
@@ -57,6 +85,98 @@ TEST(LAYER_TEST, CONVOLUTION) {
   ndarrayPtr<float, 2, 3, 28, 28> dx = conv.backward(out);
 }
 
+TEST(LAYER_TEST, CONVOLUTION_DIRECT_MATCHES_IM2COL) {
+  Convolution<float, 2, 3, 9, 7, 20, 3, 3, 2, 1> direct, im2col;
+  direct.set_algorithm(ConvAlgorithm::Direct);
+  im2col.set_algorithm(ConvAlgorithm::Im2col);
+  ASSERT_EQ(ConvAlgorithm::Direct, direct.algorithm());
+  *im2col.w = *direct.w;
+  direct.b->rand();
+  *im2col.b = *direct.b;
+
+  auto in = make_ndarray_ptr<float, 2, 3, 9, 7>();
+  in->rand();
+  auto out_d = direct.forward(in);
+  auto out_i = im2col.forward(in);
+  ASSERT_TRUE(nearly(*out_i, *out_d, 1e-4f));
+
+  auto dout = make_ndarray_ptr<float, 2, 20, 5, 4>();
+  dout->rand();
+  auto dx_d = direct.backward(dout);
+  auto dx_i = im2col.backward(dout);
+  ASSERT_TRUE(nearly(*dx_i, *dx_d, 1e-4f));
+  ASSERT_TRUE(nearly(*im2col.dw, *direct.dw, 1e-4f));
+  ASSERT_TRUE(nearly(*im2col.db, *direct.db, 1e-4f));
+}
+
+TEST(LAYER_TEST, CONVOLUTION_WINOGRAD_MATCHES_IM2COL) {
+  Convolution<float, 2, 5, 9, 7, 18, 3, 3, 1, 1> winograd, im2col;
+  winograd.set_algorithm(ConvAlgorithm::Winograd);
+  im2col.set_algorithm(ConvAlgorithm::Im2col);
+  *im2col.w = *winograd.w;
+  winograd.b->rand();
+  *im2col.b = *winograd.b;
+
+  auto in = make_ndarray_ptr<float, 2, 5, 9, 7>();
+  in->rand();
+  auto out_i = im2col.forward(in);
+  ASSERT_TRUE(nearly(*out_i, *winograd.forward(in), 1e-4f));
+  ASSERT_TRUE(nearly(*out_i, *winograd.forward(in, false), 1e-4f));
+
+  // inference reuses the filter transform until the cache is cleared
+  *winograd.w = *winograd.w * 2.0f;
+  ASSERT_TRUE(nearly(*out_i, *winograd.forward(in, false), 1e-4f));
+  winograd.clear_filter_cache();
+  *im2col.w = *winograd.w;
+  auto out_w = winograd.forward(in, false);
+  ASSERT_TRUE(nearly(*im2col.forward(in), *out_w, 1e-4f));
+  ASSERT_TRUE(nearly(*out_w, *winograd.infer(in), 1e-4f));
+  ASSERT_TRUE(nearly(*out_w, *im2col.infer(in), 1e-4f));
+
+  auto dout = make_ndarray_ptr<float, 2, 18, 9, 7>();
+  dout->rand();
+  auto dx_w = winograd.backward(dout);
+  ASSERT_TRUE(nearly(*im2col.backward(dout), *dx_w, 1e-4f));
+  ASSERT_TRUE(nearly(*im2col.dw, *winograd.dw, 1e-4f));
+
+  Convolution<float, 1, 1, 8, 8, 2, 3, 3, 2, 1> strided;
+  ASSERT_THROW(strided.set_algorithm(ConvAlgorithm::Winograd),
+               std::invalid_argument);
+}
+
+TEST(LAYER_TEST, CONVOLUTION_WINOGRAD_CONCURRENT_INFER) {
+  Convolution<float, 2, 4, 8, 8, 6, 3, 3, 1, 1> conv;
+  conv.set_algorithm(ConvAlgorithm::Winograd);
+  const auto& shared = conv;
+
+  auto in = make_ndarray_ptr<float, 2, 4, 8, 8>();
+  in->rand();
+  auto expected = conv.forward(in, false);
+
+  // infer ignores a cached transform that no longer matches w
+  *conv.w = *conv.w * 2.0f;
+  auto doubled = conv.infer(in);
+  *conv.w = *conv.w * 0.5f;
+  ASSERT_FALSE(nearly(*expected, *doubled, 1e-4f));
+  conv.clear_filter_cache();
+
+  // inference threads next to one evaluating forward and clearing the cache
+  std::vector<ndarrayPtr<float, 2, 6, 8, 8>> out(4);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 3; t++)
+    threads.emplace_back([&, t] {
+      for (int k = 0; k < 20; k++) out[t] = shared.infer(in);
+    });
+  threads.emplace_back([&] {
+    for (int k = 0; k < 20; k++) {
+      out[3] = conv.forward(in, false);
+      conv.clear_filter_cache();
+    }
+  });
+  for (auto& t : threads) t.join();
+  for (auto& y : out) ASSERT_TRUE(nearly(*expected, *y, 1e-4f));
+}
+
 TEST(LAYER_TEST, POOLING) {
   Pooling<float, 2, 3, 28, 28, 2, 2, 2> pooling;
 
@@ -68,6 +188,46 @@ TEST(LAYER_TEST, POOLING) {
   ndarrayPtr<float, 2, 3, 28, 28> dx = pooling.backward(out);
 }
 
+TEST(LAYER_TEST, POOLING_OVERLAPPING_WINDOWS) {
+  Pooling<float, 1, 2, 4, 4, 3, 3, 1> pooling;
+  AvgPooling<float, 1, 2, 4, 4, 3, 3, 1> avg;
+
+  auto in = make_ndarray_ptr<float, 1, 2, 4, 4>();
+  for (int i = 0; i < 32; i++) in->linerAt(i) = (i * 7) % 32;
+  auto out = pooling.forward(in);
+  auto mean = avg.forward(in);
+  ASSERT_TRUE(nearly(*out, *pooling.infer(in), 1e-3f));
+  ASSERT_TRUE(nearly(*mean, *avg.infer(in), 1e-3f));
+  for (int c = 0; c < 2; c++)
+    for (int oy = 0; oy < 2; oy++)
+      for (int ox = 0; ox < 2; ox++) {
+        float m = in->at(0, c, oy, ox), s = 0;
+        for (int fy = 0; fy < 3; fy++)
+          for (int fx = 0; fx < 3; fx++) {
+            m = std::max(m, in->at(0, c, oy + fy, ox + fx));
+            s += in->at(0, c, oy + fy, ox + fx);
+          }
+        ASSERT_EQ(m, out->at(0, c, oy, ox));
+        ASSERT_NEAR(s / 9, mean->at(0, c, oy, ox), 1e-5);
+      }
+
+  auto dout = make_ndarray_ptr<float, 1, 2, 2, 2>();
+  dout->fill(1);
+  auto dx = pooling.backward(dout);
+  auto dx_avg = avg.backward(dout);
+  for (int c = 0; c < 2; c++) {
+    float total = 0;
+    for (int i = 0; i < 16; i++) total += dx->at(0, c).linerAt(i);
+    ASSERT_EQ(4, total);
+    // the centre pixels are covered by all four windows
+    ASSERT_NEAR(4.0f / 9, dx_avg->at(0, c, 1, 1), 1e-5);
+    ASSERT_NEAR(1.0f / 9, dx_avg->at(0, c, 0, 0), 1e-5);
+  }
+  // both top windows of plane 1 share their maximum 30 at (0, 2)
+  ASSERT_EQ(30, in->at(0, 1, 0, 2));
+  ASSERT_EQ(2, dx->at(0, 1, 0, 2));
+}
+
 TEST(LAYER_TEST, SOFT_MAX) {
   SoftmaxWithLoss<float, 2, 10> last_layer;
 
@@ -75,4 +235,23 @@ TEST(LAYER_TEST, SOFT_MAX) {
   auto teacher = make_ndarray_ptr<float, 2, 10>();
   float loss = last_layer.forward(input, teacher);
   ndarrayPtr<float, 2, 10> dx = last_layer.backward();
+}
+
+TEST(LAYER_TEST, SOFT_MAX_SPARSE_LABELS) {
+  SoftmaxWithLoss<float, 2, 10> last_layer;
+
+  auto input = make_ndarray_ptr<float, 2, 10>();
+  input->rand();
+  auto teacher = make_ndarray_ptr<float, 2, 10>();
+  teacher->fill(0);
+  teacher->at(0, 4) = 1;
+  teacher->at(1, 7) = 1;
+  auto label = make_ndarray_ptr<uint8_t, 2>();
+  *label << 4, 7;
+
+  float loss = last_layer.forward(input, teacher);
+  auto dx = make_ndarray_ptr<float, 2, 10>();
+  *dx = *last_layer.backward();
+  ASSERT_FLOAT_EQ(loss, last_layer.forward(input, label));
+  ASSERT_TRUE(nearly(*dx, *last_layer.backward(), 1e-7f));
 }
\ No newline at end of file
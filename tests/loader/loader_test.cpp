@@ -33,10 +33,10 @@ TEST(LOADER_TEST, MNIST) {
   ASSERT_TRUE(nearly(test_ex_0_0_10, test_img->at(0, 0, 10), (float)1e-6));
 
   // sampling test label test
-  ndarray<float, 3, 10> test_label_ex_100_103;
-  test_label_ex_100_103 << 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0;
+  ndarray<uint8_t, 3> test_label_ex_100_103;
+  test_label_ex_100_103 << 6, 0, 5;
   ASSERT_EQ(test_label_ex_100_103, *(test_label->slice<0, 100, 103, 1>()));
+  ASSERT_EQ(1, mnistLoader.getTestOneHotLabel()->at(100, 6));
 
   // sampling train img test
   ndarray<float, 28> train_ex_59999_0_10;
@@ -47,9 +47,8 @@ TEST(LOADER_TEST, MNIST) {
       nearly(train_ex_59999_0_10, train_img->at(59999, 0, 10), (float)1e-6));
 
   // sampling train label test
-  ndarray<float, 3, 10> train_label_ex_59990_59993;
-  train_label_ex_59990_59993 << 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1;
+  ndarray<uint8_t, 3> train_label_ex_59990_59993;
+  train_label_ex_59990_59993 << 9, 2, 9;
   ASSERT_EQ(train_label_ex_59990_59993,
             *(train_label->slice<0, 59990, 59993, 1>()));
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <gtest/gtest.h>
 #include <algorithm>
 #include <iostream>
+#include <thread>
+#include <vector>
 #include "../src/layer/layer.hpp"
 #include "../src/network/builder.hpp"
 #include "../src/primitive/primitive.hpp"
@@ -63,6 +65,11 @@ TEST(NETWORK_TEST, ACCURACY) {
   teacher->at(1).at(9) = 1;
 
   float v = network.accuracy<1>(input, teacher);
+
+  // class indices give the same accuracy as one-hot rows
+  auto label = make_ndarray_ptr<uint8_t, 2>();
+  *label << 0, 9;
+  ASSERT_EQ(v, network.accuracy<1>(input, label));
 }
 
 TEST(NETWORK_TEST, GRADIENT) {
@@ -89,6 +96,151 @@ TEST(NETWORK_TEST, GRADIENT) {
   teacher->at(1).at(9) = 1;
 
   network.gradient(input, teacher);
+
+  auto label = make_ndarray_ptr<uint16_t, 2>();
+  *label << 0, 9;
+  network.gradient(input, label);
+}
+
+TEST(NETWORK_TEST, RELU_IN_PLACE) {
+  auto network = NetworkBuilder<3>::Input<6>()
+                     .Relu()
+                     .Affine<8>()
+                     .Relu()
+                     .Affine<4>()
+                     .SoftmaxWithLoss()
+                     .build();
+  auto& affine1 = network.next().getLayer();
+  auto& affine2 = network.next().next().next().getLayer();
+
+  // the same layers run one by one, out of place
+  Relu<float, 3, 6> relu1;
+  Affine<float, 3, 8, 6> ref1;
+  Relu<float, 3, 8> relu2;
+  Affine<float, 3, 4, 8> ref2;
+  SoftmaxWithLoss<float, 3, 4> softmax;
+  *ref1.w = *affine1.w;
+  *ref2.w = *affine2.w;
+
+  auto input = make_ndarray_ptr<float, 3, 6>();
+  input->rand();
+  *input = *input - 0.5f;
+  auto copy = make_ndarray_ptr<float, 3, 6>();
+  *copy = *input;
+  auto label = make_ndarray_ptr<uint8_t, 3>();
+  *label << 1, 3, 0;
+
+  float expected = softmax.forward(
+      ref2.forward(relu2.forward(ref1.forward(relu1.forward(input)))), label);
+  ref1.backward(relu2.backward(ref2.backward(softmax.backward())));
+
+  ASSERT_FLOAT_EQ(expected, network.loss(input, label));
+  network.backward();
+  ASSERT_FLOAT_EQ(expected, network.forward_backward(input, label));
+  ASSERT_FLOAT_EQ(expected, network.gradient(input, label));
+  ASSERT_TRUE(nearly(*ref1.dw, *affine1.dw, 1e-6f));
+  ASSERT_TRUE(nearly(*ref2.dw, *affine2.dw, 1e-6f));
+  ASSERT_TRUE(nearly(*ref1.db, *affine1.db, 1e-6f));
+
+  // the caller's input is never overwritten
+  ASSERT_TRUE(nearly(*copy, *input, 1e-7f));
+  network.predict(input);
+  ASSERT_TRUE(nearly(*copy, *input, 1e-7f));
+}
+
+TEST(NETWORK_TEST, SEEDED_RUNS_REPEAT) {
+  auto build = [] {
+    return NetworkBuilder<2>::Input<1, 8, 8>()
+        .Convolution<4, 3, 3, 1, 1>()
+        .Relu()
+        .Affine<10>()
+        .Dropout(0.5)
+        .SoftmaxWithLoss()
+        .build();
+  };
+  auto input = make_ndarray_ptr<float, 2, 1, 8, 8>();
+  input->rand();
+  auto label = make_ndarray_ptr<uint8_t, 2>();
+  *label << 3, 7;
+
+  // same seed : same weights and dropout masks, so the same loss
+  set_random_seed(2018);
+  auto first = build();
+  float loss = first.loss(input, label);
+  set_random_seed(2018);
+  auto second = build();
+  ASSERT_EQ(loss, second.loss(input, label));
+}
+
+TEST(NETWORK_TEST, EVALUATE) {
+  auto network = NetworkBuilder<4>::Input<6>()
+                     .Affine<8>()
+                     .Relu()
+                     .Affine<3>()
+                     .SoftmaxWithLoss()
+                     .build();
+  // 10 samples : two full batches and a tail of 2
+  auto input = make_ndarray_ptr<float, 10, 6>();
+  input->rand();
+  auto label = make_ndarray_ptr<uint8_t, 10>();
+  *label << 0, 1, 2, 0, 1, 2, 0, 1, 2, 0;
+
+  Evaluation<3> expected;
+  for (int i = 0; i < 3; i++) {
+    auto batch = make_ndarray_ptr<float, 4, 6>();
+    batch->fill(0);
+    for (int n = 0; n < 4 && i * 4 + n < 10; n++)
+      batch->at(n) = input->at(i * 4 + n);
+    auto y = network.predict(batch)->argmax<1>();
+    for (int n = 0; n < 4 && i * 4 + n < 10; n++)
+      expected.confusion.at(label->at(i * 4 + n), y->at(n))++;
+  }
+
+  auto result = network.evaluate<4>(input->view(), label->view());
+  ASSERT_EQ(10, result.total());
+  for (int i = 0; i < 9; i++)
+    ASSERT_EQ(expected.confusion[i], result.confusion[i]);
+  ASSERT_FLOAT_EQ(expected.accuracy(), network.accuracy<4>(input, label));
+
+  // every other sample : a strided view, copied batch by batch
+  auto even = input->view().slice<0, 0, 10, 2>();
+  auto even_label = label->view().slice<0, 0, 10, 2>();
+  ASSERT_EQ(5, network.evaluate<4>(even, even_label).total());
+  ASSERT_FLOAT_EQ(
+      network.accuracy<4>(even.copy(), even_label.copy()),
+      network.accuracy<4>(even, even_label));
+}
+
+TEST(NETWORK_TEST, CONCURRENT_INFER) {
+  auto network = NetworkBuilder<2>::Input<1, 12, 12>()
+                     .Convolution<8, 3, 3, 1, 1>()
+                     .Relu()
+                     .Pooling<2, 2, 2>()
+                     .AvgPooling<2, 2, 1>()
+                     .Affine<16>()
+                     .Relu()
+                     .Dropout(0.5)
+                     .Affine<10>()
+                     .SoftmaxWithLoss()
+                     .build();
+  const auto& shared = network;
+
+  auto input = make_ndarray_ptr<float, 2, 1, 12, 12>();
+  input->rand();
+  auto copy = make_ndarray_ptr<float, 2, 1, 12, 12>();
+  *copy = *input;
+  auto expected = network.predict(input);
+
+  // one network, many threads, no shared scratch state
+  std::vector<ndarrayPtr<float, 2, 10>> out(4);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++)
+    threads.emplace_back([&, t] {
+      for (int k = 0; k < 10; k++) out[t] = shared.infer(input);
+    });
+  for (auto& t : threads) t.join();
+  for (auto& y : out) ASSERT_TRUE(nearly(*expected, *y, 1e-2f));
+  ASSERT_TRUE(nearly(*copy, *input, 1e-7f));
 }
 
 // TEST(NETWORK_TEST, DEEP_CONV_NET) {
@@ -4,6 +4,7 @@
 
 #include <gtest/gtest.h>
 #include <iostream>
+#include <thread>
 #include "../src/primitive/primitive.hpp"
 
 using namespace dpl;
@@ -362,6 +363,28 @@ TEST(ND_ARRAY_TEST, SUM_3x4x5x6) {
   ASSERT_EQ(r4, *x.sum<3>());
 }
 
+TEST(ND_ARRAY_TEST, AXIS_REDUCTIONS_3x50x700) {
+  // large enough to split rows across chunks and argmax blocks
+  auto x = make_ndarray_ptr<float, 3, 50, 700>();
+  for (int i = 0; i < (int)x->size(); i++) x->linerAt(i) = (i * 37) % 101;
+
+  auto am = x->argmax<1>();
+  auto m = x->max<1>();
+  auto s = x->sum<1>();
+  for (int i = 0; i < 3; i++)
+    for (int k = 0; k < 700; k++) {
+      unsigned best = 0;
+      float sum = 0;
+      for (int j = 0; j < 50; j++) {
+        if (x->at(i, best, k) < x->at(i, j, k)) best = j;
+        sum += x->at(i, j, k);
+      }
+      ASSERT_EQ(best, am->at(i, k));
+      ASSERT_EQ(x->at(i, best, k), m->at(i, k));
+      ASSERT_EQ(sum, s->at(i, k));
+    }
+}
+
 TEST(ND_ARRAY_TEST, MAXIMUM_5x4x3) {
   ndarray<float, 5, 4, 3> x1;
   ndarray<float, 5, 4, 3> y1;
@@ -750,6 +773,39 @@ TEST(ND_ARRAY_TEST, CROSS_ENTROPY_ERROR) {
   ASSERT_LT((float)0.0, e);
 }
 
+TEST(ND_ARRAY_TEST, SOFTMAX_CROSS_ENTROPY) {
+  ndarray<float, 4, 10> x;
+  ndarray<unsigned, 4> label;
+  ndarray<float, 4, 10> dx;
+  x.rand();
+  label << 3, 0, 9, 3;
+
+  auto y = softmax(x);
+  float expect = 0;
+  for (int i = 0; i < 4; i++) expect -= std::log(y->at(i, label.at(i)));
+  ASSERT_NEAR(expect / 4, softmax_cross_entropy(x, label, dx), 1e-5);
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 10; j++)
+      ASSERT_NEAR((y->at(i, j) - (j == (int)label.at(i))) / 4, dx.at(i, j),
+                  1e-6);
+
+  // no overflow when the logits are large
+  ndarray<float, 1, 2> big;
+  ndarray<unsigned char, 1> t;
+  ndarray<float, 1, 2> g;
+  big << 1000, 0;
+  t << 1;
+  ASSERT_FLOAT_EQ(1000.0f, softmax_cross_entropy(big, t, g));
+  ASSERT_FLOAT_EQ(1.0f, g.at(0, 0));
+  ASSERT_FLOAT_EQ(-1.0f, g.at(0, 1));
+
+  // a label past the last class is rejected, not indexed
+  label << 3, 0, 10, 3;
+  ASSERT_THROW(softmax_cross_entropy(x, label, dx), std::out_of_range);
+  t << 2;
+  ASSERT_THROW(softmax_cross_entropy(big, t, g), std::out_of_range);
+}
+
 TEST(ND_ARRAY_TEST, NDARRAY_PTR) {
   auto ptr = make_ndarray_ptr<float, 100, 100>();
   for (int i = 0; i < 100; i++)
@@ -815,4 +871,368 @@ TEST(ND_ARRAY_TEST, MASK_AND_CHOICE) {
 TEST(ND_ARRAY_TEST, GET_DIM) {
   constexpr int k = ndarray<float, 3, 3, 3>::GetDim<0>::value;
   ASSERT_EQ(3, k);
-}
\ No newline at end of file
+}
+TEST(ND_ARRAY_TEST, CONTIGUOUS_STORAGE) {
+  static_assert(sizeof(ndarray<float, 3, 4, 5>) == sizeof(float) * 3 * 4 * 5,
+                "ndarray must not carry anything but its elements");
+  auto ptr = make_ndarray_ptr<float, 3, 4, 5>();
+  ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(ptr.get()) % 64);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 4; j++)
+      for (int k = 0; k < 5; k++)
+        ASSERT_EQ(&ptr->linerAt(i * 20 + j * 5 + k), &ptr->at(i, j, k));
+  ASSERT_EQ(&ptr->linerAt(25), &ptr->at(1).at(1).at(0));
+}
+
+TEST(ND_ARRAY_TEST, STRIDES) {
+  ndarray<float, 3, 4, 5> x;
+  ASSERT_EQ(std::make_tuple(20, 5, 1), x.strides());
+  ndarray<float, 7> y;
+  ASSERT_EQ(std::make_tuple(1), y.strides());
+  x.each([](float& v, int i) { v = i; });
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 4; j++)
+      for (int k = 0; k < 5; k++) {
+        ASSERT_FLOAT_EQ(x[i * 20 + j * 5 + k], x.at(i, j, k));
+        ASSERT_EQ(x.data() + i * 20 + j * 5 + k, &x.at(i, j, k));
+      }
+  bool catch_flag = false;
+  try {
+    x.at(0, 4, 0);
+  } catch (std::out_of_range& e) {
+    catch_flag = true;
+  }
+  ASSERT_TRUE(catch_flag);
+}
+
+TEST(ND_ARRAY_TEST, VIEW_SHARES_BUFFER) {
+  ndarray<float, 3, 4, 5> x;
+  x.each([](float& v, int i) { v = i; });
+
+  auto r = x.view().reshape<12, 5>();
+  ASSERT_EQ(x.data(), r.data());
+  r.at(3, 2) = -1;
+  ASSERT_FLOAT_EQ(-1, x.linerAt(17));
+
+  auto t = x.view().transpose<2, 0, 1>();
+  ASSERT_FALSE(t.is_contiguous());
+  ASSERT_EQ(std::make_tuple(1, 20, 5), t.strides());
+  auto xt = x.transpose<2, 0, 1>();
+  ASSERT_EQ(*xt, *t.copy());
+  ASSERT_EQ(*x.T(), *x.view().T().copy());
+  for (int i = 0; i < 60; i++) ASSERT_FLOAT_EQ(xt->linerAt(i), t.linerAt(i));
+
+  auto s = x.view().slice<1, 1, 4, 2>();
+  ASSERT_EQ(std::make_tuple(3, 1, 5), s.shape());
+  ASSERT_EQ(&x.at(2, 1, 3), &s.at(2, 0, 3));
+  auto xs = x.slice<1, 1, 4, 2>();
+  ASSERT_EQ(*xs, *s.copy());
+}
+
+TEST(ND_ARRAY_TEST, RESHAPE_PTR_NO_COPY) {
+  auto x = make_ndarray_ptr<float, 2, 6>();
+  x->fill(1);
+  auto y = reshape<3, 2, 2>(x);
+  ASSERT_EQ(x->data(), y->data());
+  y->at(2, 1, 1) = 5;
+  ASSERT_FLOAT_EQ(5, x->at(1, 5));
+}
+
+TEST(ND_ARRAY_TEST, EXPRESSION_FUSED) {
+  ndarray<float, 3, 4> a, b, c, expect;
+  a.each([](float& v, int i) { v = i; });
+  b.each([](float& v, int i) { v = (i * 7) % 5; });
+  c.each([](float& v, int i) { v = 1 + i % 3; });
+  for (int i = 0; i < 12; i++) expect[i] = (a[i] - b[i] * 0.5f) / c[i] + 1;
+
+  auto e = (a - b * 0.5f) / c + 1.0f;
+  ASSERT_EQ(12, e.size());
+  ASSERT_EQ(expect, e);
+  ASSERT_EQ(expect, *e.eval());
+
+  // assigning to an operand is evaluated element by element in place
+  const float* p = a.data();
+  a = (a - b * 0.5f) / c + 1.0f;
+  ASSERT_EQ(p, a.data());
+  ASSERT_EQ(expect, a);
+
+  ndarrayPtr<float, 3, 4> m = maximum(a, b);
+  for (int i = 0; i < 12; i++) ASSERT_FLOAT_EQ(std::max(a[i], b[i]), (*m)[i]);
+  a.at(1) = exp(b.at(1));
+  ASSERT_FLOAT_EQ(std::exp(b.at(1, 2)), a.at(1, 2));
+}
+
+TEST(ND_ARRAY_TEST, EXPRESSION_OWNS_OPERANDS) {
+  auto a = make_ndarray_ptr<float, 2, 3>();
+  auto b = make_ndarray_ptr<float, 2, 3>();
+  a->each([](float& v, int i) { v = i; });
+  b->fill(2);
+
+  // ndarray operands are copied, a temporary operand may die and a later
+  // change to a does not show through
+  auto e = *a - *(*b * 0.5f).eval();
+  auto f = a * *b;
+  a->fill(10);
+  for (int i = 0; i < 6; i++) ASSERT_FLOAT_EQ(i - 1, e[i]);
+
+  // ndarrayPtr operands are shared
+  for (int i = 0; i < 6; i++) ASSERT_FLOAT_EQ(20, f[i]);
+  ndarrayPtr<float, 2, 3> g = exp(b) + a;
+  ASSERT_FLOAT_EQ(std::exp(2.0f) + 10, g->at(1, 2));
+}
+
+TEST(ND_ARRAY_TEST, COMPOUND_ASSIGNMENT) {
+  ndarray<float, 2, 3> a, b, expect;
+  a.each([](float& v, int i) { v = i; });
+  b.each([](float& v, int i) { v = i + 1; });
+  const float* p = a.data();
+
+  a += b;
+  a -= 1.0f;
+  a *= b;
+  a /= 2.0f;
+  axpy(2.0f, b, a);
+  for (int i = 0; i < 6; i++) expect[i] = (i + i + 1 - 1) * (i + 1) / 2.0f;
+  for (int i = 0; i < 6; i++) expect[i] += 2 * (i + 1);
+  ASSERT_EQ(p, a.data());
+  ASSERT_EQ(expect, a);
+
+  a -= a * 0.5f;
+  for (int i = 0; i < 6; i++) ASSERT_FLOAT_EQ(expect[i] / 2, a[i]);
+}
+
+TEST(ND_ARRAY_TEST, BROADCAST_ALONG_AXIS) {
+  ndarray<float, 2, 3, 4> x;
+  x.fill(1);
+  ndarray<float, 3> v;
+  v << 1, 2, 3;
+
+  add_along<1>(x, v);
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < 4; k++) ASSERT_FLOAT_EQ(1 + v[j], x.at(i, j, k));
+
+  ndarray<float, 4> w;
+  w << 1, 2, 3, 4;
+  mul_along<2>(x, w);
+  ndarray<float, 2> u;
+  u << 0, 1;
+  sub_along<0>(x, u);
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < 4; k++)
+        ASSERT_FLOAT_EQ((1 + v[j]) * w[k] - i, x.at(i, j, k));
+}
+
+TEST(ND_ARRAY_TEST, GEMM_KERNELS) {
+  constexpr int M = 37, K = 400, N = 53;
+  ndarray<float, M, K> a;
+  ndarray<float, K, N> b;
+  a.rand();
+  b.rand();
+  ndarray<float, M, N> expect;
+  for (int i = 0; i < M; i++)
+    for (int j = 0; j < N; j++) {
+      double s = 0;
+      for (int p = 0; p < K; p++) s += (double)a.at(i, p) * b.at(p, j);
+      expect.at(i, j) = s;
+    }
+  auto bt = b.T();
+
+  for (auto kernel : {GemmKernel::Portable, GemmKernel::Avx2,
+                      GemmKernel::Avx512}) {
+    if (!set_gemm_kernel(kernel)) continue;
+    ASSERT_EQ(kernel, gemm_kernel());
+    ASSERT_TRUE(nearly(expect, *dot(a, b), 1e-3f));
+
+    // B read through strides, accumulated onto C
+    ndarray<float, M, N> c;
+    c.fill(1);
+    gemm(M, N, K, a.data(), K, 1, bt->data(), 1, K, c.data(), N, true);
+    ASSERT_TRUE(nearly(*(expect + 1.0f).eval(), c, 1e-3f));
+  }
+  ASSERT_TRUE(set_gemm_kernel(GemmKernel::Auto));
+}
+
+TEST(ND_ARRAY_TEST, DOT_TRANSPOSED_OPERANDS) {
+  ndarray<float, 5, 7> a;
+  ndarray<float, 7, 3> b;
+  a.each([](float& v, int i) { v = i % 11; });
+  b.each([](float& v, int i) { v = (i * 3) % 7; });
+  auto expect = dot(a, b);
+
+  ASSERT_EQ(*expect, *dot_nt(a, *b.T()));
+  ASSERT_EQ(*expect, *dot_tn(*a.T(), b));
+}
+
+TEST(THREAD_POOL_TEST, PARALLEL_FOR) {
+  const int threads = num_threads();
+  set_num_threads(4);
+  ASSERT_EQ(4, num_threads());
+
+  std::vector<int> hits(10007, 0);
+  parallel_for(0, hits.size(), [&](int lo, int hi) {
+    // nested loops are run by the waiting threads
+    parallel_for(lo, hi, [&](int l, int h) {
+      for (int i = l; i < h; i++) hits[i]++;
+    }, 16);
+  });
+  for (int v : hits) ASSERT_EQ(1, v);
+
+  bool catch_flag = false;
+  try {
+    parallel_for(0, 100, [](int lo, int hi) {
+      if (lo <= 50 && 50 < hi) throw std::out_of_range("parallel_for");
+    });
+  } catch (std::out_of_range& e) {
+    catch_flag = true;
+  }
+  ASSERT_TRUE(catch_flag);
+
+  auto sum = parallel_reduce(
+      1, 100001, 0LL,
+      [](int lo, int hi) {
+        long long s = 0;
+        for (int i = lo; i < hi; i++) s += i;
+        return s;
+      },
+      [](long long a, long long b) { return a + b; }, 1000);
+  ASSERT_EQ(5000050000LL, sum);
+
+  set_num_threads(threads);
+}
+
+TEST(THREAD_POOL_TEST, KERNELS_MATCH_SERIAL) {
+  const int threads = num_threads();
+  ndarray<float, 300, 200> a;
+  ndarray<float, 200, 70> b;
+  a.rand();
+  b.rand();
+  auto x = make_ndarray_ptr<float, 4, 3, 9, 9>();
+  x->rand();
+
+  set_num_threads(1);
+  auto c1 = dot(a, b);
+  auto col1 = x->im2col<3, 3, 1, 1>();
+  auto e1 = (a * 2.0f + 1.0f).eval();
+
+  set_num_threads(5);
+  ASSERT_EQ(*c1, *dot(a, b));
+  auto col5 = x->im2col<3, 3, 1, 1>();
+  ASSERT_EQ(*col1, *col5);
+  ASSERT_EQ(*e1, a * 2.0f + 1.0f);
+
+  set_num_threads(threads);
+}
+
+TEST(ND_ARRAY_TEST, IM2COL_PATCHES) {
+  constexpr int N = 2, C = 3, H = 5, W = 4, FH = 3, FW = 2, S = 2, P = 1;
+  constexpr int OH = (H + 2 * P - FH) / S + 1;
+  constexpr int OW = (W + 2 * P - FW) / S + 1;
+  ndarray<float, N, C, H, W> x;
+  x.each([](float& v, int i) { v = i + 1; });
+
+  ndarray<float, N * OH * OW, C * FH * FW> col;
+  col.fill(-1);
+  x.im2col<FH, FW, S, P>(col);
+  for (int n = 0; n < N; n++)
+    for (int oy = 0; oy < OH; oy++)
+      for (int ox = 0; ox < OW; ox++)
+        for (int c = 0; c < C; c++)
+          for (int fy = 0; fy < FH; fy++)
+            for (int fx = 0; fx < FW; fx++) {
+              int iy = oy * S + fy - P, ix = ox * S + fx - P;
+              float v = (0 <= iy && iy < H && 0 <= ix && ix < W)
+                            ? x.at(n, c, iy, ix)
+                            : 0;
+              ASSERT_FLOAT_EQ(v, col.at((n * OH + oy) * OW + ox,
+                                        (c * FH + fy) * FW + fx));
+            }
+  auto col2 = x.im2col<FH, FW, S, P>();
+  ASSERT_EQ(col, *col2);
+}
+
+TEST(ND_ARRAY_TEST, COL2IM_ACCUMULATES) {
+  constexpr int N = 2, C = 3, H = 6, W = 5;
+  constexpr int M = N * H * W, K = C * 3 * 3;
+  ndarray<float, N, C, H, W> ones;
+  ones.fill(1);
+  auto img = ones.im2col<3, 3, 1, 1>()->col2im<N, C, H, W, 3, 3, 1, 1>();
+  // every pixel is covered by one tap per neighbour inside the image
+  for (int y = 0; y < H; y++)
+    for (int x = 0; x < W; x++) {
+      float cover =
+          (3 - (y == 0) - (y == H - 1)) * (3 - (x == 0) - (x == W - 1));
+      ASSERT_FLOAT_EQ(cover, img->at(1, 2, y, x));
+    }
+
+  // col2im is the adjoint of im2col : <im2col(x), y> == <x, col2im(y)>
+  ndarray<float, N, C, H, W> x;
+  ndarray<float, M, K> y;
+  x.rand();
+  y.rand();
+  auto col = x.im2col<3, 3, 1, 1>();
+  ndarray<float, N, C, H, W> back;
+  y.col2im<N, C, H, W, 3, 3, 1, 1>(back);
+  double lhs = 0, rhs = 0;
+  for (int i = 0; i < M * K; i++) lhs += (*col)[i] * y[i];
+  for (int i = 0; i < N * C * H * W; i++) rhs += x[i] * back[i];
+  ASSERT_NEAR(lhs, rhs, 1e-3);
+}
+
+TEST(RANDOM_TEST, PHILOX) {
+  // known answers of Philox4x32-10 (Random123)
+  std::uint32_t bits[PHILOX_BLOCK];
+  philox4x32_block(0, 0, bits);
+  ASSERT_EQ(0x6627e8d5u, bits[0]);
+  ASSERT_EQ(0xe169c58du, bits[16]);
+  ASSERT_EQ(0xbc57ac4cu, bits[32]);
+  ASSERT_EQ(0x9b00dbd8u, bits[48]);
+
+  // rand() draws from the thread's engine : the same seed, the same values
+  ndarray<float, 3, 700> a, b;
+  random_engine().seed(42);
+  a.rand();
+  random_engine().seed(42);
+  b.rand();
+  for (int i = 0; i < (int)a.size(); i++) {
+    ASSERT_EQ(a[i], b[i]);
+    ASSERT_LE(0.0f, a[i]);
+    ASSERT_GT(1.0f, a[i]);
+  }
+  double mean = 0;
+  for (int i = 0; i < (int)a.size(); i++) mean += a[i];
+  ASSERT_NEAR(0.5, mean / a.size(), 0.03);
+
+  // dropout masks keep about 1 - ratio of the bits, none past SIZE
+  bitmask<1000> mask;
+  random_keep_mask(mask, 0.3f);
+  ASSERT_LT(640, mask.count());
+  ASSERT_GT(760, mask.count());
+  random_keep_mask(mask, 1.0f);
+  ASSERT_EQ(0, mask.count());
+  random_keep_mask(mask, -1.0f);
+  ASSERT_GE(1000, mask.count());
+  ASSERT_LT(990, mask.count());
+}
+
+TEST(RANDOM_TEST, SEED) {
+  ndarray<float, 2, 300> a, b, c;
+  set_random_seed(1234);
+  ASSERT_EQ(1234u, random_seed());
+  a.rand();
+  set_random_seed(1234);
+  b.rand();
+  ASSERT_TRUE(nearly(a, b, 1e-7f));
+
+  // an explicit engine on the same seed and stream 0 replays the sequence
+  philox_engine engine(1234);
+  c.rand(engine);
+  ASSERT_TRUE(nearly(a, c, 1e-7f));
+
+  // another thread draws from its own stream
+  set_random_seed(1234);
+  std::thread([&] { c.rand(); }).join();
+  ASSERT_EQ(0u, random_engine().stream());
+  ASSERT_FALSE(nearly(a, c, 1e-7f));
+}
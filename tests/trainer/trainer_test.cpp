@@ -80,4 +80,95 @@ TEST(TRSINER_TEST, XOR) {
       network, optimizer, x_train, x_label, t_train, t_label, 500);
 
   trainer.train();
-}
\ No newline at end of file
+}
+
+TEST(TRAINER_TEST, SPARSE_LABELS) {
+  constexpr int TRAIN_NUM = 4;
+  constexpr int BATCH_NUM = 2;
+  constexpr int N = 2;
+  constexpr int M = 2;
+
+  auto network = NetworkBuilder<BATCH_NUM>::Input<N>()
+                     .Affine<M>()
+                     .SoftmaxWithLoss()
+                     .buildPtr();
+  auto optimizer = SGD(0.01);
+  auto x_train = make_ndarray_ptr<float, TRAIN_NUM, N>();
+  *x_train << 0, 0, 0, 1, 1, 0, 1, 1;
+  auto x_label = make_ndarray_ptr<uint8_t, TRAIN_NUM>();
+  *x_label << 0, 1, 1, 0;
+
+  auto trainer = Trainer<BATCH_NUM, 2, decltype(network), decltype(optimizer),
+                         decltype(x_train), decltype(x_label),
+                         decltype(x_train), decltype(x_label)>(
+      network, optimizer, x_train, x_label, x_train, x_label, 2);
+  trainer.train();
+
+  // class indices score the same as the one-hot rows they stand for
+  auto one_hot = make_ndarray_ptr<float, TRAIN_NUM, M>();
+  *one_hot << 1, 0, 0, 1, 0, 1, 1, 0;
+  auto x_batch = make_ndarray_ptr<float, BATCH_NUM, N>();
+  *x_batch << 0, 1, 1, 1;
+  auto t_batch = make_ndarray_ptr<float, BATCH_NUM, M>();
+  *t_batch << 0, 1, 1, 0;
+  auto l_batch = make_ndarray_ptr<uint8_t, BATCH_NUM>();
+  *l_batch << 1, 0;
+  ASSERT_FLOAT_EQ(network->loss(x_batch, t_batch),
+                  network->loss(x_batch, l_batch));
+  ASSERT_FLOAT_EQ(network->accuracy<BATCH_NUM>(x_train, one_hot),
+                  network->accuracy<BATCH_NUM>(x_train, x_label));
+}
+TEST(TRAINER_TEST, EPOCH_SAMPLER) {
+  EpochSampler<10, 3> sampler;
+  auto x = make_ndarray_ptr<float, 10, 2>();
+  for (int i = 0; i < 10; i++) x->at(i) << i, -i;
+  auto batch = make_ndarray_ptr<float, 3, 2>();
+
+  for (int epoch = 0; epoch < 3; epoch++) {
+    // no sample twice within an epoch
+    std::vector<int> seen(10, 0);
+    for (int b = 0; b < EpochSampler<10, 3>::BATCHES_PER_EPOCH; b++) {
+      const int* index = sampler.next();
+      x->gather<3>(index, *batch);
+      for (int r = 0; r < 3; r++) {
+        ASSERT_EQ(1, ++seen[index[r]]);
+        ASSERT_EQ(index[r], batch->at(r, 0));
+        ASSERT_EQ(-index[r], batch->at(r, 1));
+      }
+    }
+    ASSERT_EQ(epoch, sampler.epoch());
+  }
+}
+
+TEST(TRAINER_TEST, PREFETCHER) {
+  auto x = make_ndarray_ptr<float, 12, 3>();
+  auto t = make_ndarray_ptr<uint8_t, 12>();
+  for (int i = 0; i < 12; i++) {
+    x->at(i) << i, 2 * i, 3 * i;
+    t->at(i) = i;
+  }
+
+  // batches come out in sampler order whatever the number of producers
+  set_random_seed(7);
+  EpochSampler<12, 4> sampler;
+  std::vector<int> expected;
+  for (int b = 0; b < 9; b++) {
+    const int* index = sampler.next();
+    expected.insert(expected.end(), index, index + 4);
+  }
+  for (int producers = 1; producers <= 3; producers++) {
+    set_random_seed(7);
+    Prefetcher<4, ndarray<float, 12, 3>, ndarray<uint8_t, 12>> prefetcher(
+        x, t, 2, producers);
+    for (int b = 0; b < 9; b++) {
+      auto batch = prefetcher.next();
+      for (int r = 0; r < 4; r++) {
+        const int i = expected[b * 4 + r];
+        ASSERT_EQ(i, batch.second->at(r));
+        ASSERT_EQ(3 * i, batch.first->at(r, 2));
+      }
+    }
+    ASSERT_EQ(9, prefetcher.stats().batches);
+    ASSERT_GE(9, prefetcher.stats().stalls);
+  }
+}